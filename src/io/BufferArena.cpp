@@ -0,0 +1,217 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "BufferArena.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+
+namespace io {
+
+// base page size, for pre-faulting
+const uint64_t smallPageBytes = 4096;
+// PMD size on x86-64, if kernel doesn't report its transparent huge page size
+const uint64_t defaultTHPPageBytes = 2 * 1024 * 1024;
+
+BufferArena::BufferArena(uint64_t slotLen, uint64_t numSlots, uint64_t alignment,
+							uint64_t hugePageBytes, bool lock,
+							const NumaTopology *topology, uint32_t node) :
+	slotLen_(((slotLen + alignment - 1)/alignment) * alignment),
+	numSlots_(numSlots),
+	slotsPerRegion_(0),
+	numRegions_(0),
+	data_(nullptr),
+	regions_(nullptr),
+	nextSlot_(0),
+	backing_(ARENA_HEAP),
+	hugePageBytes_(0),
+	map_(nullptr),
+	mapLen_(0),
+	locked_(false)
+{
+	if (!slotLen_ || !numSlots_ || slotLen_ > maxArenaRegionLen)
+		return;
+	uint64_t len = slotLen_ * numSlots_;
+	if (hugePageBytes && (hugePageBytes & (hugePageBytes - 1)) == 0 &&
+			(mapHugeTLB(len, hugePageBytes) || mapTHP(len, hugePageBytes))) {
+		// huge pages are aligned well beyond any O_DIRECT alignment
+		data_ = map_;
+		if (topology)
+			bindMemoryToNumaNode(*topology, node, map_, mapLen_);
+		prefault(map_, mapLen_, backing_ == ARENA_HUGETLB ? hugePageBytes : smallPageBytes);
+		if (lock) {
+			locked_ = mlock(map_, mapLen_) == 0;
+			if (!locked_)
+				printf("Unable to lock buffer arena in memory : %s\n", strerror(errno));
+		}
+	} else if (topology) {
+		// pages are placed on node before they are first touched
+		len = ((len + smallPageBytes - 1) / smallPageBytes) * smallPageBytes;
+		data_ = IOBuf::alignedAlloc(std::max(alignment, smallPageBytes), len);
+		if (!data_)
+			return;
+		bindMemoryToNumaNode(*topology, node, data_, len);
+		prefault(data_, len, smallPageBytes);
+	} else {
+		data_ = IOBuf::alignedAlloc(alignment, len);
+		if (!data_)
+			return;
+	}
+	slotsPerRegion_ = maxArenaRegionLen / slotLen_;
+	numRegions_ = (uint32_t)((numSlots_ + slotsPerRegion_ - 1) / slotsPerRegion_);
+	regions_ = new io[numRegions_];
+	for (uint32_t i = 0; i < numRegions_; ++i){
+		uint64_t firstSlot = i * slotsPerRegion_;
+		uint64_t slots = std::min(slotsPerRegion_, numSlots_ - firstSlot);
+		regions_[i].iov_base = data_ + firstSlot * slotLen_;
+		regions_[i].iov_len  = slots * slotLen_;
+	}
+}
+BufferArena::~BufferArena(){
+	delete[] regions_;
+	if (map_)
+		munmap(map_, mapLen_);
+	else
+		free(data_);
+}
+// map slab from hugetlb pool. Fails if pool has too few free pages
+bool BufferArena::mapHugeTLB(uint64_t len, uint64_t hugePageBytes){
+#ifdef MAP_HUGETLB
+	uint64_t mapLen = ((len + hugePageBytes - 1) / hugePageBytes) * hugePageBytes;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+	// page size is encoded as its base 2 logarithm
+	int shift = 0;
+	while (((uint64_t)1 << shift) < hugePageBytes)
+		shift++;
+	flags |= shift << MAP_HUGE_SHIFT;
+#endif
+	void *map = mmap(nullptr, mapLen, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (map == MAP_FAILED)
+		return false;
+	map_ = (uint8_t*)map;
+	mapLen_ = mapLen;
+	backing_ = ARENA_HUGETLB;
+	hugePageBytes_ = hugePageBytes;
+
+	return true;
+#else
+	(void)len;
+	(void)hugePageBytes;
+
+	return false;
+#endif
+}
+// map slab aligned to huge page size, and advise kernel to back it
+// with transparent huge pages
+bool BufferArena::mapTHP(uint64_t len, uint64_t hugePageBytes){
+#ifdef MADV_HUGEPAGE
+	// transparent huge pages are always PMD sized, whatever size was asked for
+	hugePageBytes = thpPageBytes();
+	uint64_t mapLen = ((len + hugePageBytes - 1) / hugePageBytes) * hugePageBytes;
+	// over-allocate by one huge page, then trim to an aligned mapping
+	uint64_t rawLen = mapLen + hugePageBytes;
+	void *raw = mmap(nullptr, rawLen, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return false;
+	auto begin = (uint8_t*)raw;
+	auto aligned = (uint8_t*)((((uintptr_t)raw + hugePageBytes - 1) / hugePageBytes) * hugePageBytes);
+	if (aligned > begin)
+		munmap(begin, (size_t)(aligned - begin));
+	uint64_t tail = (uint64_t)(begin + rawLen - (aligned + mapLen));
+	if (tail)
+		munmap(aligned + mapLen, tail);
+	if (madvise(aligned, mapLen, MADV_HUGEPAGE) != 0)
+		printf("Transparent huge pages unavailable : %s\n", strerror(errno));
+	map_ = aligned;
+	mapLen_ = mapLen;
+	backing_ = ARENA_THP;
+	hugePageBytes_ = hugePageBytes;
+
+	return true;
+#else
+	(void)len;
+	(void)hugePageBytes;
+
+	return false;
+#endif
+}
+// size of transparent huge pages
+uint64_t BufferArena::thpPageBytes(void){
+	uint64_t pageBytes = defaultTHPPageBytes;
+	FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+	if (fp) {
+		unsigned long val;
+		if (fscanf(fp, "%lu", &val) == 1 && val && (val & (val - 1)) == 0)
+			pageBytes = val;
+		fclose(fp);
+	}
+
+	return pageBytes;
+}
+// touch every page, so that no buffer write faults
+void BufferArena::prefault(uint8_t *addr, uint64_t len, uint64_t pageBytes){
+	for (uint64_t off = 0; off < len; off += pageBytes)
+		((volatile uint8_t*)addr)[off] = 0;
+}
+// bytes of mapping backed by transparent huge pages, from /proc/self/smaps
+uint64_t BufferArena::thpBytes(void) const{
+	FILE *fp = fopen("/proc/self/smaps", "r");
+	if (!fp)
+		return 0;
+	char line[256];
+	bool inArena = false;
+	uint64_t kb = 0;
+	while (fgets(line, sizeof(line), fp)){
+		unsigned long start, end;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			inArena = start <= (uintptr_t)map_ && (uintptr_t)map_ < end;
+			continue;
+		}
+		unsigned long val;
+		if (inArena && sscanf(line, "AnonHugePages: %lu kB", &val) == 1)
+			kb += val;
+	}
+	fclose(fp);
+
+	return std::min<uint64_t>(kb * 1024, mapLen_);
+}
+ArenaStats BufferArena::getStats(void) const{
+	ArenaStats stats;
+	stats.slots_ = numSlots_;
+	stats.served_ = std::min(nextSlot_.load(), numSlots_);
+	stats.hugePageBytes_ = hugePageBytes_;
+	stats.transparent_ = backing_ == ARENA_THP;
+	stats.locked_ = locked_;
+	if (backing_ == ARENA_HUGETLB) {
+		stats.hugeServed_ = stats.served_;
+	} else if (backing_ == ARENA_THP && mapLen_) {
+		// kernel only reports how much of the mapping is backed by huge pages,
+		// so buffers are assumed to be spread evenly over them
+		stats.hugeServed_ = (uint64_t)((double)stats.served_ *
+								(double)thpBytes() / (double)mapLen_);
+	}
+
+	return stats;
+}
+
+}
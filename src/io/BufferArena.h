@@ -0,0 +1,121 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+#include "IFileIO.h"
+#include "IOStats.h"
+#include "NumaTopology.h"
+
+namespace io {
+
+// largest buffer that can be registered with the kernel in one piece
+const uint64_t maxArenaRegionLen = (uint64_t)1 << 30;
+
+// how the memory of an arena is backed
+enum ArenaBacking {
+	// regular heap allocation
+	ARENA_HEAP,
+	// explicit huge pages from the hugetlb pool (MAP_HUGETLB)
+	ARENA_HUGETLB,
+	// anonymous mapping advised for transparent huge pages
+	ARENA_THP
+};
+
+/*
+ * A BufferArena is a single slab of memory divided into equal sized slots.
+ * Each slot is handed out once, as an IOBuf that wraps the slot's memory.
+ * The slab is split into a small number of regions which can be registered
+ * with the kernel once, up front - every IOBuf carved from the arena stores
+ * the index of its region in index_.
+ *
+ * If a huge page size is given, the slab is mapped from the hugetlb pool,
+ * falling back to transparent huge pages if the pool is too small. A mapped
+ * slab is pre-faulted, and optionally locked in memory, so that neither
+ * page faults nor page pinning show up on the write path.
+ * If a NUMA node is given, the slab is placed on that node before it is
+ * pre-faulted.
+ *
+ * Slots are never returned to the arena: once carved, an IOBuf circulates
+ * through the buffer pools like any other pool buffer, and the slab is only
+ * freed when the arena is destroyed. get() may be called from any thread.
+ */
+class BufferArena
+{
+  public:
+	// hugePageBytes is zero for a heap slab, or the size of huge pages to map.
+	// topology is nullptr, or the topology holding node
+	BufferArena(uint64_t slotLen, uint64_t numSlots, uint64_t alignment,
+				uint64_t hugePageBytes, bool lock,
+				const NumaTopology *topology, uint32_t node);
+	~BufferArena();
+	bool valid(void) const{
+		return data_ != nullptr;
+	}
+	// returns nullptr if len does not fit in a slot, or if arena is exhausted
+	IOBuf* get(uint64_t len){
+		if (!data_ || len > slotLen_)
+			return nullptr;
+		uint64_t slot = nextSlot_++;
+		if (slot >= numSlots_)
+			return nullptr;
+		auto b = new IOBuf();
+		b->attach(data_ + slot * slotLen_, slotLen_, (uint32_t)(slot / slotsPerRegion_));
+
+		return b;
+	}
+	uint64_t slotLen(void) const{
+		return slotLen_;
+	}
+	uint64_t numSlots(void) const{
+		return numSlots_;
+	}
+	uint32_t numRegions(void) const{
+		return numRegions_;
+	}
+	const io* regions(void) const{
+		return regions_;
+	}
+	ArenaBacking backing(void) const{
+		return backing_;
+	}
+	ArenaStats getStats(void) const;
+  private:
+	bool mapHugeTLB(uint64_t len, uint64_t hugePageBytes);
+	bool mapTHP(uint64_t len, uint64_t hugePageBytes);
+	void prefault(uint8_t *addr, uint64_t len, uint64_t pageBytes);
+	uint64_t thpBytes(void) const;
+	static uint64_t thpPageBytes(void);
+	uint64_t slotLen_;
+	uint64_t numSlots_;
+	uint64_t slotsPerRegion_;
+	uint32_t numRegions_;
+	uint8_t *data_;
+	io *regions_;
+	std::atomic<uint64_t> nextSlot_;
+	ArenaBacking backing_;
+	uint64_t hugePageBytes_;
+	// mapping that holds the slab, if not allocated from heap
+	uint8_t *map_;
+	uint64_t mapLen_;
+	bool locked_;
+};
+
+}
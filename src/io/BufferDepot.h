@@ -0,0 +1,109 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+#include "IFileIO.h"
+#include "MPMCQueue.h"
+
+namespace io {
+
+// maximum number of distinct buffer lengths held by a depot
+const uint32_t maxDepotLengths = 16;
+// maximum number of magazines held for each length
+const uint32_t maxDepotMagazines = 256;
+
+/*
+ * A BufferDepot is a lock-free store of magazines shared by all buffer pools
+ * of an image, so that buffers migrate from pools with a surplus to pools
+ * that run short : i.e. from the worker that completes shared chunks to the
+ * worker that allocates them.
+ *
+ * A magazine is a chain of equal length buffers, linked through poolNext_.
+ * Magazines of each length are kept in a bounded lock-free queue. A length
+ * claims one of the depot's slots the first time it is stored.
+ */
+class BufferDepot
+{
+  public:
+	BufferDepot()
+	{
+		for (uint32_t i = 0; i < maxDepotLengths; ++i){
+			lens_[i] = 0;
+			magazines_[i] = new MPMCQueue<IOBuf*>(maxDepotMagazines);
+		}
+	}
+	~BufferDepot(){
+		for (uint32_t i = 0; i < maxDepotLengths; ++i){
+			IOBuf *magazine;
+			while (magazines_[i]->pop(magazine))
+				release(magazine);
+			delete magazines_[i];
+		}
+	}
+	BufferDepot(const BufferDepot&) = delete;
+	BufferDepot& operator=(const BufferDepot&) = delete;
+	// store magazine of buffers of length allocLen.
+	// Buffers are released if depot is full
+	void put(IOBuf *magazine, uint64_t allocLen){
+		int32_t i = slot(allocLen, true);
+		if (i < 0 || !magazines_[i]->push(magazine))
+			release(magazine);
+	}
+	// returns a magazine of buffers of length allocLen, or nullptr if there is none
+	IOBuf* get(uint64_t allocLen){
+		int32_t i = slot(allocLen, false);
+		IOBuf *magazine = nullptr;
+		if (i >= 0)
+			magazines_[i]->pop(magazine);
+
+		return magazine;
+	}
+  private:
+	// index of slot holding allocLen, claiming a free slot if claim is true.
+	// Returns -1 if there is no such slot
+	int32_t slot(uint64_t allocLen, bool claim){
+		for (uint32_t i = 0; i < maxDepotLengths; ++i){
+			uint64_t len = lens_[i].load(std::memory_order_acquire);
+			if (len == allocLen)
+				return (int32_t)i;
+			if (len)
+				continue;
+			if (!claim)
+				return -1;
+			if (lens_[i].compare_exchange_strong(len, allocLen) || len == allocLen)
+				return (int32_t)i;
+		}
+
+		return -1;
+	}
+	static void release(IOBuf *magazine){
+		while (magazine){
+			auto next = magazine->poolNext_;
+			magazine->poolNext_ = nullptr;
+			RefReaper::unref(magazine);
+			magazine = next;
+		}
+	}
+	std::atomic<uint64_t> lens_[maxDepotLengths];
+	MPMCQueue<IOBuf*> *magazines_[maxDepotLengths];
+};
+
+}
@@ -18,47 +18,269 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
 #include <thread>
 #include <mutex>
-
 #include "IFileIO.h"
 #include "IBufferPool.h"
+#include "BufferArena.h"
+#include "BufferDepot.h"
+#include "MemoryBudget.h"
+#include "IOStats.h"
+#include "NumaTopology.h"
 
 namespace io {
 
+// number of buffers moved between a pool and its depot at once
+const uint32_t magazineSize = 8;
+
+/*
+ * Pool of buffers binned by exact allocation length. Each bin is an
+ * intrusive free list threaded through the pooled buffers, so get() and put()
+ * are O(1), and a request is never served by a larger buffer of another
+ * length : O_DIRECT writes transfer a buffer's whole allocation.
+ * Arena slots are interchangeable, so they share the bin of the slot length,
+ * which serves any request that fits in a slot.
+ *
+ * Each worker has its own pool, which acts as a cache in front of a shared
+ * depot : a bin that grows to two magazines hands one magazine to the depot,
+ * and an empty bin is refilled with a magazine from the depot, before any
+ * new buffer is allocated. The pool lock is only contended when a buffer is
+ * reclaimed by another thread, i.e. a completion reaper.
+ *
+ * If a memory budget is set, every buffer handed out is charged to it,
+ * and credited back when the buffer is returned. Buffers are first charged
+ * to the pool's reservation, i.e. room the worker has already reserved
+ * in the budget.
+ */
 class BufferPool : public IBufferPool
 {
   public:
-	BufferPool() = default;
+	BufferPool() : BufferPool(nullptr)
+	{}
+	// new buffers are carved from arena, if possible
+	explicit BufferPool(BufferArena *arena) : arena_(arena), depot_(nullptr),
+											budget_(nullptr),
+											reserved_(0),
+											alignment_(defaultAlignment),
+											sampleNuma_(false)
+	{}
+	// memory alignment of new buffers
+	void setAlignment(uint64_t alignment){
+		alignment_ = alignment;
+	}
+	uint64_t alignment(void) const{
+		return alignment_;
+	}
+	// record NUMA node of each new buffer in its numaNode_
+	void setNumaSampling(bool sample){
+		sampleNuma_ = sample;
+	}
+	bool numaSampling(void) const{
+		return sampleNuma_;
+	}
+	// share surplus buffers with other pools through depot
+	void setDepot(BufferDepot *depot){
+		depot_ = depot;
+	}
+	BufferDepot* depot(void) const{
+		return depot_;
+	}
+	// charge buffers handed out to budget
+	void setBudget(MemoryBudget *budget){
+		budget_ = budget;
+	}
+	// len bytes were reserved in budget for buffers about to be handed out
+	void reserve(uint64_t len){
+		std::lock_guard<std::mutex> lock(mutex_);
+		reserved_ += len;
+	}
+	// credit budget with reservation not drawn on by buffers handed out
+	void releaseReservation(void){
+		uint64_t reserved = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::swap(reserved, reserved_);
+		}
+		if (reserved && budget_)
+			budget_->credit(reserved);
+	}
 	virtual ~BufferPool(){
-		for(std::pair<uint8_t*, IOBuf*> p : pool)
-			RefReaper::unref(p.second);
+		for (auto &bin : bins_){
+			auto b = bin.second.head_;
+			while (b){
+				auto next = b->poolNext_;
+				RefReaper::unref(b);
+				b = next;
+			}
+		}
 	}
 	IOBuf* get(uint64_t len) override{
-		for(auto iter = pool.begin(); iter != pool.end(); ++iter)
-		{
-			if(iter->second->allocLen_ >= len)
-			{
-				auto b = iter->second;
-				assert(b->data_);
-				pool.erase(iter);
-				assert(b->data_);
-				return b;
+		uint64_t slotLen = arena_ ? arena_->slotLen() : 0;
+		std::unique_lock<std::mutex> lock(mutex_);
+		stats_.gets_++;
+		stats_.requestedBytes_ += len;
+		auto b = pop(len);
+		if (!b && len <= slotLen)
+			b = pop(slotLen);
+		if (!b && depot_) {
+			lock.unlock();
+			uint64_t allocLen = len;
+			auto magazine = depot_->get(allocLen);
+			if (!magazine && len <= slotLen) {
+				allocLen = slotLen;
+				magazine = depot_->get(allocLen);
+			}
+			lock.lock();
+			if (magazine) {
+				stats_.depotGets_++;
+				// first buffer serves request, and the rest refill the bin
+				b = magazine;
+				auto rest = b->poolNext_;
+				b->poolNext_ = nullptr;
+				auto &bin = bins_[allocLen];
+				while (rest) {
+					auto next = rest->poolNext_;
+					rest->poolNext_ = bin.head_;
+					bin.head_ = rest;
+					bin.count_++;
+					rest = next;
+				}
 			}
 		}
-		auto b = new IOBuf();
-		b->alloc(len);
-		assert(b->data_);
+		if (b) {
+			stats_.hits_++;
+			stats_.servedBytes_ += b->allocLen_;
+			charge(b->allocLen_);
+			return b;
+		}
+		lock.unlock();
+		b = allocate(len);
+		lock.lock();
+		charge(b->allocLen_);
+		stats_.servedBytes_ += b->allocLen_;
+
 		return b;
 	}
+	// may be called by a completion reaper thread
 	void put(IOBuf *b) override{
+		if (budget_)
+			budget_->credit(b->allocLen_);
+		std::unique_lock<std::mutex> lock(mutex_);
 		assert(b->data_);
-		assert(pool.find(b->data_) == pool.end());
-		pool[b->data_] = b;
+		assert(!b->poolNext_);
+		auto &bin = bins_[b->allocLen_];
+		b->poolNext_ = bin.head_;
+		bin.head_ = b;
+		bin.count_++;
+		if (!depot_ || bin.count_ < 2 * magazineSize)
+			return;
+		// hand a magazine of surplus buffers to depot
+		auto magazine = bin.head_;
+		auto last = magazine;
+		for (uint32_t i = 1; i < magazineSize; ++i)
+			last = last->poolNext_;
+		bin.head_ = last->poolNext_;
+		bin.count_ -= magazineSize;
+		last->poolNext_ = nullptr;
+		stats_.depotPuts_++;
+		uint64_t allocLen = b->allocLen_;
+		lock.unlock();
+		depot_->put(magazine, allocLen);
+	}
+	// stock pool with count buffers of length len, touching every page
+	// so that their first use doesn't fault. Pre-warmed buffers are not
+	// counted as requests, and are not charged to a budget.
+	void prewarm(uint32_t count, uint64_t len){
+		uint64_t start = nowNs();
+		uint64_t bytes = 0;
+		IOBuf *head = nullptr;
+		for (uint32_t i = 0; i < count; ++i){
+			auto b = allocate(len);
+			memset(b->data_, 0, b->allocLen_);
+			bytes += b->allocLen_;
+			b->poolNext_ = head;
+			head = b;
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		while (head){
+			auto next = head->poolNext_;
+			auto &bin = bins_[head->allocLen_];
+			head->poolNext_ = bin.head_;
+			bin.head_ = head;
+			bin.count_++;
+			head = next;
+		}
+		stats_.prewarmed_ += count;
+		stats_.prewarmedBytes_ += bytes;
+		stats_.prewarmNs_ += nowNs() - start;
+	}
+	PoolStats getStats(void) const{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return stats_;
 	}
   private:
-	std::map<uint8_t*, IOBuf*> pool;
+	struct Bin {
+		Bin() : head_(nullptr), count_(0)
+		{}
+		IOBuf *head_;
+		uint32_t count_;
+	};
+	// called with mutex held : charge buffer to reservation, and charge
+	// budget with any shortfall, i.e. a buffer longer than requested
+	void charge(uint64_t allocLen){
+		if (!budget_)
+			return;
+		uint64_t fromReservation = std::min(reserved_, allocLen);
+		reserved_ -= fromReservation;
+		if (allocLen > fromReservation)
+			budget_->charge(allocLen - fromReservation);
+	}
+	// new buffer, carved from arena if possible
+	IOBuf* allocate(uint64_t len){
+		IOBuf *b = arena_ ? arena_->get(len) : nullptr;
+		if (!b) {
+			b = new IOBuf();
+			b->alloc(len, alignment_);
+			assert(b->data_);
+		}
+		// node is sampled here, rather than on every write, as it takes
+		// a system call. An untouched page has no node yet, so the first
+		// page is touched first, i.e. on the allocating worker's node
+		if (sampleNuma_) {
+			b->data_[0] = 0;
+			b->numaNode_ = numaNodeOfAddress(b->data_);
+		}
+
+		return b;
+	}
+	// called with mutex held
+	IOBuf* pop(uint64_t allocLen){
+		auto iter = bins_.find(allocLen);
+		if (iter == bins_.end() || !iter->second.head_)
+			return nullptr;
+		auto &bin = iter->second;
+		auto b = bin.head_;
+		bin.head_ = b->poolNext_;
+		bin.count_--;
+		b->poolNext_ = nullptr;
+		assert(b->data_);
+
+		return b;
+	}
+	// free list of each allocation length
+	std::unordered_map<uint64_t, Bin> bins_;
+	BufferArena *arena_;
+	BufferDepot *depot_;
+	MemoryBudget *budget_;
+	// bytes reserved in budget, not yet drawn on
+	uint64_t reserved_;
+	uint64_t alignment_;
+	bool sampleNuma_;
+	PoolStats stats_;
+	mutable std::mutex mutex_;
 };
 
 }
@@ -0,0 +1,153 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#ifdef IOBENCH_HAVE_URING
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#include "CompletionReaper.h"
+#include "FileIOUring.h"
+#include "util.h"
+
+namespace io {
+
+// upper bound on time spent sleeping before checking for new or removed rings
+const int maxSleepMs = 10;
+
+CompletionReaper::CompletionReaper(const IOParams &params) :
+		mode_(params.completionMode_),
+		intervalUs_(params.reaperIntervalUs_),
+		busyPollNs_((uint64_t)params.busyPollUs_ * 1000),
+		stop_(false),
+		thread_(&CompletionReaper::run, this)
+{
+}
+CompletionReaper::~CompletionReaper(){
+	stop_ = true;
+	thread_.join();
+	closeRetired();
+}
+bool CompletionReaper::bindToNumaNode(const NumaTopology &topology, uint32_t node){
+	return bindThreadToNumaNode(topology, node, thread_.native_handle());
+}
+bool CompletionReaper::add(FileIOUring *ring){
+	if (mode_ == COMPLETION_EVENTFD || mode_ == COMPLETION_BUSY_POLL){
+		int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (efd < 0){
+			printf("eventfd: %s\n", strerror(errno));
+			return false;
+		}
+		int ret = io_uring_register_eventfd(&ring->ring, efd);
+		if (ret < 0){
+			printf("io_uring_register_eventfd: %s\n", strerror(-ret));
+			::close(efd);
+			return false;
+		}
+		ring->eventFd_ = efd;
+	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	rings_.push_back(ring);
+
+	return true;
+}
+// the ring's eventfd may be polled by the reaper thread at this point,
+// so it is closed by the thread, once it no longer polls it
+void CompletionReaper::remove(FileIOUring *ring){
+	std::lock_guard<std::mutex> lock(mutex_);
+	rings_.erase(std::remove(rings_.begin(), rings_.end(), ring), rings_.end());
+	if (ring->eventFd_ != -1){
+		io_uring_unregister_eventfd(&ring->ring);
+		retiredFds_.push_back(ring->eventFd_);
+		ring->eventFd_ = -1;
+	}
+}
+// called with mutex held, or once thread has stopped
+void CompletionReaper::closeRetired(void){
+	for (auto fd : retiredFds_)
+		::close(fd);
+	retiredFds_.clear();
+}
+uint32_t CompletionReaper::reapAll(void){
+	std::lock_guard<std::mutex> lock(mutex_);
+	uint32_t count = 0;
+	for (auto ring : rings_)
+		count += ring->reap();
+
+	return count;
+}
+// sleep until a completion is posted to one of the rings.
+// The eventfds are polled without holding the lock, so that rings can be
+// added and removed meanwhile : eventfds of removed rings stay open
+// until the next call
+void CompletionReaper::waitEvents(void){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closeRetired();
+		pollFds_.resize(rings_.size());
+		for (size_t i = 0; i < rings_.size(); ++i){
+			pollFds_[i].fd = rings_[i]->eventFd_;
+			pollFds_[i].events = POLLIN;
+			pollFds_[i].revents = 0;
+		}
+	}
+	if (pollFds_.empty()){
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return;
+	}
+	if (poll(pollFds_.data(), pollFds_.size(), maxSleepMs) <= 0)
+		return;
+	for (auto &fd : pollFds_){
+		if (fd.revents & POLLIN){
+			eventfd_t val;
+			eventfd_read(fd.fd, &val);
+		}
+	}
+}
+void CompletionReaper::run(void){
+	uint64_t idleSince = nowNs();
+	while (!stop_){
+		if (reapAll()){
+			idleSince = nowNs();
+			continue;
+		}
+		switch(mode_){
+			case COMPLETION_BUSY_POLL:
+				if (nowNs() - idleSince < busyPollNs_)
+					break;
+				waitEvents();
+				idleSince = nowNs();
+				break;
+			case COMPLETION_EVENTFD:
+				waitEvents();
+				break;
+			default:
+				std::this_thread::sleep_for(std::chrono::microseconds(intervalUs_));
+				break;
+		}
+	}
+}
+
+}
+
+#endif
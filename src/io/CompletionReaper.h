@@ -0,0 +1,77 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#ifdef IOBENCH_HAVE_URING
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <poll.h>
+
+#include "IOParams.h"
+#include "NumaTopology.h"
+
+namespace io {
+
+class FileIOUring;
+
+/*
+ * A CompletionReaper owns a thread that reaps completions for a group of
+ * worker rings, so that buffers are reclaimed as soon as their writes
+ * complete, rather than on the worker's next write or at close.
+ * How the thread waits for completions depends on the CompletionMode.
+ *
+ * Once a ring is added, the reaper is the only consumer of its
+ * completion queue, until the ring is removed.
+ */
+class CompletionReaper
+{
+  public:
+	CompletionReaper(const IOParams &params);
+	~CompletionReaper();
+	bool add(FileIOUring *ring);
+	void remove(FileIOUring *ring);
+	// run reaper thread on cpus of node
+	bool bindToNumaNode(const NumaTopology &topology, uint32_t node);
+
+  private:
+	void run(void);
+	uint32_t reapAll(void);
+	void waitEvents(void);
+	void closeRetired(void);
+
+	CompletionMode mode_;
+	uint64_t intervalUs_;
+	uint64_t busyPollNs_;
+	std::vector<FileIOUring*> rings_;
+	// eventfds of rings, as last polled by reaper thread
+	std::vector<pollfd> pollFds_;
+	// eventfds of removed rings, to be closed by reaper thread
+	std::vector<int> retiredFds_;
+	std::mutex mutex_;
+	std::atomic<bool> stop_;
+	std::thread thread_;
+};
+
+}
+
+#endif
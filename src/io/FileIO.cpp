@@ -41,6 +41,14 @@ void FileIO::registerReclaimCallback(io_callback reclaim_callback,
 	reclaim_user_data_ = user_data;
 }
 
+void FileIO::setIOParams(const IOParams &params){
+	params_ = params;
+}
+
+IOStats FileIO::getStats(void) const{
+	return stats_;
+}
+
 void FileIO::enableSimulateWrite(void){
 	simulateWrite_ = true;
 }
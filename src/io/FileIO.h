@@ -22,6 +22,8 @@
 
 #include "config.h"
 #include "IFileIO.h"
+#include "IOParams.h"
+#include "IOStats.h"
 
 namespace io {
 
@@ -32,6 +34,8 @@ public:
 	void enableSimulateWrite(void);
 	void setMaxSimulatedWrites(uint64_t maxRequests);
 	virtual void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
+	virtual void setIOParams(const IOParams &params);
+	virtual IOStats getStats(void) const;
 	static bool isDirect(std::string mode);
 	static uint64_t bytesToWrite(IOBuf **buffers, uint32_t numBuffers, std::string mode);
 protected:
@@ -42,6 +46,8 @@ protected:
 	void* reclaim_user_data_;
 	std::string filename_;
 	std::string mode_;
+	IOParams params_;
+	IOStats stats_;
 	bool simulateWrite_;
 	bool flushOnClose_;
 	uint32_t threadId_;
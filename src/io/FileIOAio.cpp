@@ -0,0 +1,346 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#ifdef IOBENCH_HAVE_LINUX_AIO
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include "FileIOAio.h"
+#include "FileIO.h"
+#include "util.h"
+
+namespace io {
+
+// glibc has no wrappers for the AIO system calls
+static int aioSetup(unsigned nr, aio_context_t *ctx){
+	return (int)syscall(__NR_io_setup, nr, ctx);
+}
+static int aioDestroy(aio_context_t ctx){
+	return (int)syscall(__NR_io_destroy, ctx);
+}
+static int aioSubmit(aio_context_t ctx, long nr, iocb **cbs){
+	return (int)syscall(__NR_io_submit, ctx, nr, cbs);
+}
+static int aioGetEvents(aio_context_t ctx, long minNr, long nr,
+						io_event *events, timespec *timeout){
+	return (int)syscall(__NR_io_getevents, ctx, minNr, nr, events, timeout);
+}
+
+// maximum number of completions retrieved by a single io_getevents call
+const uint32_t maxEvents = 64;
+
+FileIOAio::FileIOAio(uint32_t threadId)
+	: ctx_(0), fd_(-1), iocbs_(nullptr), queuedBytes_(0), submitted_(0),
+	  failed_(false), writeBehind_(nullptr),
+	  reclaim_callback_(nullptr), reclaim_user_data_(nullptr),
+	  threadId_(threadId)
+{}
+FileIOAio::~FileIOAio(){
+	close();
+}
+bool FileIOAio::active(void) const{
+	return ctx_ != 0;
+}
+void FileIOAio::prewarmRequests(uint32_t count, uint32_t numBuffers){
+	scheduleDataPool_.prewarm(count, numBuffers);
+}
+const IOStats& FileIOAio::getStats(void) const{
+	return stats_;
+}
+void FileIOAio::registerReclaimCallback(io_callback reclaim_callback,
+												  void* user_data)
+{
+	reclaim_callback_ = reclaim_callback;
+	reclaim_user_data_ = user_data;
+}
+void FileIOAio::setIOParams(const IOParams &params){
+	params_ = params;
+}
+void FileIOAio::setWriteBehind(WriteBehind *writeBehind){
+	writeBehind_ = writeBehind;
+}
+bool FileIOAio::attach(std::string mode, int fd){
+	mode_ = mode;
+	fd_ = fd;
+	if (mode[0] == 'r')
+		return true;
+
+	return initContext();
+}
+bool FileIOAio::attach(const FileIOAio *parent){
+	if (!parent->active())
+		return true;
+	params_ = parent->params_;
+
+	return attach(parent->mode_, parent->fd_);
+}
+bool FileIOAio::initContext(void){
+	uint32_t queueDepth = std::max<uint32_t>(params_.queueDepth_, 1);
+	int ret = aioSetup(queueDepth, &ctx_);
+	if (ret < 0) {
+		printf("io_setup: %s\n", strerror(errno));
+		ctx_ = 0;
+		return false;
+	}
+	iocbs_ = new iocb[queueDepth];
+	freeIocbs_.reserve(queueDepth);
+	for (uint32_t i = 0; i < queueDepth; ++i)
+		freeIocbs_.push_back(iocbs_ + queueDepth - 1 - i);
+	queued_.reserve(queueDepth);
+
+	return true;
+}
+// back pressure : block on completions while all control blocks are in use.
+// Returns nullptr if no control block can be freed, i.e. if nothing is in
+// flight or waiting for completions fails
+iocb* FileIOAio::getIocb(void){
+	while (freeIocbs_.empty()) {
+		stats_.waits_++;
+		// control blocks of a failed submit are freed
+		if (!queued_.empty() && !submit())
+			continue;
+		if (!submitted_ || !reap(true, false))
+			return nullptr;
+	}
+	auto cb = freeIocbs_.back();
+	freeIocbs_.pop_back();
+
+	return cb;
+}
+void FileIOAio::prepOp(iocb *cb, IOScheduleOp *op){
+	memset(cb, 0, sizeof(iocb));
+	cb->aio_data = (uint64_t)(uintptr_t)op;
+	cb->aio_lio_opcode = op->read_ ? IOCB_CMD_PREADV : IOCB_CMD_PWRITEV;
+	cb->aio_fildes = (uint32_t)fd_;
+	cb->aio_buf = (uint64_t)(uintptr_t)(op->data_->iov_ + op->firstBuffer_);
+	cb->aio_nbytes = op->numBuffers_;
+	cb->aio_offset = (int64_t)op->offset_;
+}
+// Returns false if request could not be queued : it is then failed,
+// and its buffers are reclaimed
+bool FileIOAio::enqueue(IOScheduleData* data){
+	data->enqueueTime_ = nowNs();
+	data->initOps(false, false, false);
+	auto cb = getIocb();
+	if (!cb) {
+		printf("Asynchronous write of %lu bytes at offset %lu failed : "
+				"no control block available\n", data->totalBytes_, data->offset_);
+		stats_.errors_++;
+		failed_ = true;
+		finishRequest(data, false);
+		return false;
+	}
+	prepOp(cb, data->ops_);
+	queued_.push_back(cb);
+	queuedBytes_ += data->totalBytes_;
+	stats_.writes_++;
+	bool doSubmit = (params_.batchOps_ && queued_.size() >= params_.batchOps_) ||
+						(params_.batchBytes_ && queuedBytes_ >= params_.batchBytes_);
+	if (doSubmit)
+		submit();
+	if (submitted_)
+		reap(false, false);
+
+	return true;
+}
+// hand all queued control blocks to the kernel.
+// Returns false if they could not be submitted : their operations are then failed
+bool FileIOAio::submit(void){
+	size_t done = 0;
+	int err = 0;
+	while (done < queued_.size()) {
+		stats_.submits_++;
+		int ret = aioSubmit(ctx_, (long)(queued_.size() - done), queued_.data() + done);
+		if (ret > 0) {
+			done += (size_t)ret;
+			submitted_ += (uint32_t)ret;
+			continue;
+		}
+		err = ret < 0 ? errno : EIO;
+		// kernel is out of resources : make room by reaping completions
+		if (err == EAGAIN || err == EINTR) {
+			if (submitted_)
+				reap(true, false);
+			continue;
+		}
+		break;
+	}
+	queuedBytes_ = 0;
+	if (done == queued_.size()) {
+		queued_.clear();
+		return true;
+	}
+	printf("io_submit: %s\n", strerror(err));
+	std::vector<iocb*> unsubmitted(queued_.begin() + (ptrdiff_t)done, queued_.end());
+	queued_.clear();
+	for (auto cb : unsubmitted) {
+		auto op = (IOScheduleOp*)(uintptr_t)cb->aio_data;
+		stats_.errors_++;
+		failed_ = true;
+		freeIocbs_.push_back(cb);
+		if (--op->data_->pendingOps_ == 0)
+			finishRequest(op->data_, false);
+	}
+
+	return false;
+}
+// Process completions : wait for at least one completion if wait is true.
+// Incomplete operations are queued to be reissued.
+// Returns number of completions processed
+uint32_t FileIOAio::reap(bool wait, bool closing){
+	io_event events[maxEvents];
+	timespec noWait = {0, 0};
+	int ret;
+	do {
+		ret = aioGetEvents(ctx_, wait ? 1 : 0, maxEvents, events, wait ? nullptr : &noWait);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		printf("io_getevents: %s\n", strerror(errno));
+		return 0;
+	}
+	for (int i = 0; i < ret; ++i) {
+		auto cb = (iocb*)(uintptr_t)events[i].obj;
+		auto op = (IOScheduleOp*)(uintptr_t)events[i].data;
+		submitted_--;
+		if (!finishOp(op, events[i].res)) {
+			// reissue remainder with same control block
+			prepOp(cb, op);
+			queued_.push_back(cb);
+			continue;
+		}
+		freeIocbs_.push_back(cb);
+		auto data = op->data_;
+		if (--data->pendingOps_ == 0)
+			finishRequest(data, closing);
+	}
+
+	return (uint32_t)ret;
+}
+// Check result of a completed operation.
+// Returns true if operation is finished, either because all of its bytes
+// were transferred, or because it failed. Otherwise, the operation is
+// advanced past the transferred bytes, to be reissued for the remainder.
+bool FileIOAio::finishOp(IOScheduleOp *op, int64_t res){
+	uint64_t remaining = op->remaining();
+	if (res >= 0 && (uint64_t)res >= remaining)
+		return true;
+	int err = 0;
+	if (res == 0)
+		err = EIO;
+	else if (res < 0 && res != -EAGAIN && res != -EINTR)
+		err = (int)-res;
+	else if (op->retries_ == maxOpRetries)
+		err = res < 0 ? (int)-res : EIO;
+	if (err) {
+		printf("Asynchronous %s of %lu bytes at offset %lu failed with error:\n%s\n",
+				op->read_ ? "read" : "write", remaining, op->offset_, strerror(err));
+		stats_.errors_++;
+		failed_ = true;
+		return true;
+	}
+	if (res > 0)
+		op->advance((uint64_t)res);
+	op->retries_++;
+	stats_.retries_++;
+
+	return false;
+}
+// reclaim buffers of a completed request.
+// When closing, buffers are released rather than recycled.
+void FileIOAio::finishRequest(IOScheduleData *data, bool closing){
+	stats_.addReclaim(nowNs() - data->enqueueTime_);
+	if (writeBehind_)
+		writeBehind_->written(data->offset_, data->totalBytes_);
+	for (uint32_t i = 0; i < data->numBuffers_; ++i){
+		auto b = data->buffers_[i];
+		if (closing)
+			RefReaper::unref(b);
+		else
+			reclaim_callback_(threadId_, b, reclaim_user_data_);
+	}
+	scheduleDataPool_.put(data);
+}
+bool FileIOAio::flush(void){
+	if (!active() || queued_.empty())
+		return true;
+
+	return submit();
+}
+// submit queued writes, and reclaim buffers of completed writes
+// without blocking
+bool FileIOAio::poll(void){
+	if (!active())
+		return true;
+	if (!flush())
+		return false;
+	reap(false, false);
+
+	// short completions are queued for reissue
+	return flush();
+}
+bool FileIOAio::close(void){
+	if (!active())
+		return true;
+	// submit queued requests, then wait for all pending requests
+	while (!queued_.empty() || submitted_) {
+		if (!queued_.empty())
+			submit();
+		if (submitted_ && !reap(true, true))
+			break;
+	}
+	aioDestroy(ctx_);
+	ctx_ = 0;
+	delete[] iocbs_;
+	iocbs_ = nullptr;
+	freeIocbs_.clear();
+	queued_.clear();
+	queuedBytes_ = 0;
+	submitted_ = 0;
+	fd_ = -1;
+	bool rc = !failed_;
+	failed_ = false;
+
+	return rc;
+}
+// Bytes are reported as written once they are queued. A failed operation
+// is reported by all subsequent writes, and by close()
+uint64_t FileIOAio::write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers){
+	if (failed_) {
+		for (uint32_t i = 0; i < numBuffers; ++i)
+			reclaim_callback_(threadId_, buffers[i], reclaim_user_data_);
+		return 0;
+	}
+	auto data = scheduleDataPool_.get(offset,buffers,numBuffers,FileIO::isDirect(mode_));
+	uint64_t toWrite = FileIO::bytesToWrite(buffers, numBuffers, mode_);
+	if (!enqueue(data))
+		return 0;
+
+	return toWrite;
+}
+
+}
+
+#endif
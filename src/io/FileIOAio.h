@@ -0,0 +1,98 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#ifdef IOBENCH_HAVE_LINUX_AIO
+
+#include <linux/aio_abi.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "IFileIO.h"
+#include "IOParams.h"
+#include "IOStats.h"
+#include "WriteBehind.h"
+#include "IOScheduleDataPool.h"
+
+namespace io {
+
+/*
+ * Asynchronous writes through the Linux native AIO interface
+ * (io_submit / io_getevents), for kernels without io_uring.
+ * Writes are only asynchronous in O_DIRECT mode : buffered writes
+ * complete inside io_submit.
+ *
+ * Each writer thread has its own AIO context, and reaps its own completions.
+ */
+class FileIOAio : public IFileIO
+{
+  public:
+	FileIOAio(uint32_t threadId);
+	virtual ~FileIOAio() override;
+	bool close(void) override;
+	uint64_t write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers) override;
+
+	// aio-specific
+	void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
+	void setIOParams(const IOParams &params);
+	bool attach(std::string mode, int fd);
+	bool attach(const FileIOAio *parent);
+	void setWriteBehind(WriteBehind *writeBehind);
+	bool flush(void);
+	bool poll(void);
+	bool active(void) const;
+	void prewarmRequests(uint32_t count, uint32_t numBuffers);
+	const IOStats& getStats(void) const;
+
+  private:
+	bool initContext(void);
+	iocb* getIocb(void);
+	void prepOp(iocb *cb, IOScheduleOp *op);
+	bool enqueue(IOScheduleData* data);
+	bool submit(void);
+	uint32_t reap(bool wait, bool closing);
+	bool finishOp(IOScheduleOp *op, int64_t res);
+	void finishRequest(IOScheduleData *data, bool closing);
+
+	aio_context_t ctx_;
+	int fd_;
+	std::string mode_;
+	IOParams params_;
+	IOStats stats_;
+	// one control block per operation in flight
+	iocb *iocbs_;
+	std::vector<iocb*> freeIocbs_;
+	// control blocks prepared but not yet handed to the kernel
+	std::vector<iocb*> queued_;
+	uint64_t queuedBytes_;
+	// operations handed to the kernel and not yet completed
+	uint32_t submitted_;
+	// set when an operation fails : file is incomplete
+	bool failed_;
+	WriteBehind *writeBehind_;
+	IOScheduleDataPool scheduleDataPool_;
+	io_callback reclaim_callback_;
+	void* reclaim_user_data_;
+	uint32_t threadId_;
+};
+
+}
+
+#endif
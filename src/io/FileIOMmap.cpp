@@ -0,0 +1,189 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "FileIOMmap.h"
+#include "util.h"
+
+namespace io {
+
+FileIOMmap::FileIOMmap(uint32_t threadId) : fd_(invalid_fd),
+											data_(nullptr),
+											len_(0),
+											ownsMapping_(false),
+											writeBehind_(nullptr),
+											reclaim_callback_(nullptr),
+											reclaim_user_data_(nullptr),
+											threadId_(threadId),
+											freeBuffers_(nullptr)
+{}
+FileIOMmap::~FileIOMmap(){
+	close();
+	while (freeBuffers_){
+		auto next = freeBuffers_->poolNext_;
+		freeBuffers_->poolNext_ = nullptr;
+		RefReaper::unref(freeBuffers_);
+		freeBuffers_ = next;
+	}
+}
+void FileIOMmap::registerReclaimCallback(io_callback reclaim_callback, void* user_data){
+	reclaim_callback_ = reclaim_callback;
+	reclaim_user_data_ = user_data;
+}
+void FileIOMmap::setIOParams(const IOParams &params){
+	params_ = params;
+}
+void FileIOMmap::setWriteBehind(WriteBehind *writeBehind){
+	writeBehind_ = writeBehind;
+}
+const IOStats& FileIOMmap::getStats(void) const{
+	return stats_;
+}
+bool FileIOMmap::active(void) const{
+	return data_ != nullptr;
+}
+// size file to len, and map it
+bool FileIOMmap::map(int fd, uint64_t len){
+	if (!close())
+		return false;
+	if (ftruncate(fd, (off_t)len) != 0){
+		printf("ftruncate: %s\n", strerror(errno));
+		return false;
+	}
+	void *data = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED){
+		printf("mmap: %s\n", strerror(errno));
+		return false;
+	}
+	fd_ = fd;
+	data_ = (uint8_t*)data;
+	len_ = len;
+	ownsMapping_ = true;
+
+	return true;
+}
+void FileIOMmap::attach(const FileIOMmap *parent){
+	params_ = parent->params_;
+	fd_ = parent->fd_;
+	data_ = parent->data_;
+	len_ = parent->len_;
+	ownsMapping_ = false;
+}
+IOBuf* FileIOMmap::getBuffer(uint64_t offset, uint64_t len){
+	if (!data_ || offset + len > len_)
+		return nullptr;
+	auto b = freeBuffers_;
+	if (b) {
+		freeBuffers_ = b->poolNext_;
+		b->poolNext_ = nullptr;
+	} else {
+		b = new IOBuf();
+	}
+	b->attach(data_ + offset, len, unregistered_index);
+	b->offset_ = offset;
+
+	return b;
+}
+uint64_t FileIOMmap::write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers){
+	uint64_t start = nowNs();
+	uint64_t bytesWritten = 0;
+	uint64_t pos = offset;
+	for (uint32_t i = 0; i < numBuffers; ++i){
+		auto b = buffers[i];
+		auto dest = data_ + pos;
+		bool inPlace = b->data_ == dest;
+		if (pos + b->len_ <= len_) {
+			if (!inPlace)
+				memcpy(dest, b->data_, b->len_);
+			bytesWritten += b->len_;
+		} else {
+			printf("mmap write of %lu bytes at offset %lu exceeds mapping length %lu\n",
+					b->len_, pos, len_);
+			stats_.errors_++;
+		}
+		pos += b->len_;
+		// buffers that wrap the mapping go back to this writer's free list
+		if (inPlace) {
+			b->poolNext_ = freeBuffers_;
+			freeBuffers_ = b;
+		} else {
+			reclaim_callback_(threadId_, b, reclaim_user_data_);
+		}
+	}
+	stats_.writes_++;
+	stats_.addReclaim(nowNs() - start);
+	release(offset, std::min(pos, len_) - std::min(offset, len_));
+
+	return bytesWritten;
+}
+// start writeback of written range, handing it over to write-behind if
+// enabled, and unmap its pages from this process if cache dropping is
+// enabled : with a shared mapping, dirty pages stay in the page cache
+void FileIOMmap::release(uint64_t offset, uint64_t len){
+	if (!len)
+		return;
+	uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	if (writeBehind_ && params_.writeBehindBytes_) {
+		writeBehind_->written(offset, len);
+	} else {
+#ifdef __linux__
+		// msync with MS_ASYNC doesn't start writeback on Linux
+		sync_file_range(fd_, (off64_t)offset, (off64_t)len, SYNC_FILE_RANGE_WRITE);
+#else
+		uint64_t first = (offset / page) * page;
+		msync(data_ + first, offset + len - first, MS_ASYNC);
+#endif
+	}
+	if (!params_.dropCache_)
+		return;
+	uint64_t begin = ((offset + page - 1) / page) * page;
+	uint64_t end = ((offset + len) / page) * page;
+	if (end > begin)
+		madvise(data_ + begin, end - begin, MADV_DONTNEED);
+}
+bool FileIOMmap::close(void){
+	bool rc = true;
+	if (data_ && ownsMapping_) {
+		if (msync(data_, len_, MS_SYNC) != 0){
+			printf("msync: %s\n", strerror(errno));
+			rc = false;
+		}
+		munmap(data_, len_);
+	}
+	fd_ = invalid_fd;
+	data_ = nullptr;
+	len_ = 0;
+	ownsMapping_ = false;
+
+	return rc;
+}
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#ifndef _WIN32
+
+#include <cstdint>
+
+#include "IFileIO.h"
+#include "IOParams.h"
+#include "IOStats.h"
+#include "WriteBehind.h"
+
+namespace io {
+
+/*
+ * Writes through a shared memory mapping of the output file.
+ *
+ * Workers may ask for buffers that point straight into the mapping, so that
+ * pixels are written in place : writing such a buffer needs no copy and no
+ * system call. Once written, such buffers are kept on a free list and
+ * reused for the worker's next strip. Other buffers, i.e. chunks shared
+ * between strips, are copied into the mapping.
+ *
+ * Writeback of each written range is started as soon as the range is
+ * written, either by write-behind or directly, so that the flush on close
+ * mostly waits for writeback already under way.
+ *
+ * The mapping is owned by the serializer that maps the file, and is shared
+ * by attached worker serializers.
+ */
+class FileIOMmap : public IFileIO
+{
+  public:
+	FileIOMmap(uint32_t threadId);
+	virtual ~FileIOMmap() override;
+	bool close(void) override;
+	uint64_t write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers) override;
+
+	// mmap-specific
+	void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
+	void setIOParams(const IOParams &params);
+	void setWriteBehind(WriteBehind *writeBehind);
+	bool map(int fd, uint64_t len);
+	void attach(const FileIOMmap *parent);
+	bool active(void) const;
+	// buffer wrapping the mapping at offset, or nullptr if out of range
+	IOBuf* getBuffer(uint64_t offset, uint64_t len);
+	const IOStats& getStats(void) const;
+
+  private:
+	void release(uint64_t offset, uint64_t len);
+	int fd_;
+	uint8_t *data_;
+	uint64_t len_;
+	bool ownsMapping_;
+	IOParams params_;
+	IOStats stats_;
+	WriteBehind *writeBehind_;
+	io_callback reclaim_callback_;
+	void* reclaim_user_data_;
+	uint32_t threadId_;
+	// written buffers that wrapped the mapping, linked through poolNext_
+	IOBuf *freeBuffers_;
+};
+
+}
+
+#endif
@@ -20,10 +20,23 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cerrno>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "FileIOUnix.h"
+#include "WriteOffloader.h"
+#include "RingAggregator.h"
+#include "util.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 namespace io {
 
@@ -32,8 +45,17 @@ FileIOUnix::FileIOUnix(uint32_t threadId, bool flushOnClose) :
 #ifdef IOBENCH_HAVE_URING
 	  uring(threadId),
 #endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	  aio_(threadId),
+#endif
+	  mmap_(threadId),
 	  fd_(invalid_fd),
-	  ownsFileDescriptor_(false)
+	  ownsFileDescriptor_(false),
+	  offloader_(nullptr),
+	  aggregator_(nullptr),
+	  noWaitSupported_(true),
+	  offloadPending_(0),
+	  offloadFailed_(false)
 {
 }
 FileIOUnix::~FileIOUnix(void){
@@ -43,20 +65,123 @@ void FileIOUnix::registerReclaimCallback(io_callback reclaim_callback,
 												 void* user_data)
 {
 	FileIO::registerReclaimCallback(reclaim_callback, user_data);
+	mmap_.registerReclaimCallback(reclaim_callback, user_data);
 #ifdef IOBENCH_HAVE_URING
 	uring.registerReclaimCallback(reclaim_callback, user_data);
 #endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	aio_.registerReclaimCallback(reclaim_callback, user_data);
+#endif
+}
+void FileIOUnix::setIOParams(const IOParams &params){
+	FileIO::setIOParams(params);
+	mmap_.setIOParams(params);
+#ifdef IOBENCH_HAVE_URING
+	uring.setIOParams(params);
+#endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	aio_.setIOParams(params);
+#endif
+}
+IOStats FileIOUnix::getStats(void) const{
+	IOStats stats = FileIO::getStats();
+	{
+		std::lock_guard<std::mutex> lock(offloadMutex_);
+		stats.add(offloadStats_);
+	}
+	stats.add(mmap_.getStats());
+#ifdef IOBENCH_HAVE_URING
+	stats.add(uring.getStats());
+#endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	stats.add(aio_.getStats());
+#endif
+
+	return stats;
+}
+bool FileIOUnix::flush(void){
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	if (aio_.active())
+		return aio_.flush();
+#endif
+#ifdef IOBENCH_HAVE_URING
+	return uring.flush();
+#else
+	return true;
+#endif
+}
+// make progress on asynchronous writes, without blocking
+bool FileIOUnix::poll(void){
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	if (aio_.active())
+		return aio_.poll();
+#endif
+#ifdef IOBENCH_HAVE_URING
+	return uring.poll();
+#else
+	return true;
+#endif
 }
 bool FileIOUnix::attach(FileIOUnix *parent){
 	fd_ = parent->fd_;
 	mode_ = parent->mode_;
+	params_ = parent->params_;
+	if (!FileIO::isDirect(mode_))
+		writeBehind_.init(fd_, params_.writeBehindBytes_, params_.dropCache_);
+	if (parent->mmap_.active()) {
+		mmap_.attach(&parent->mmap_);
+		mmap_.setWriteBehind(&writeBehind_);
+	}
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	aio_.setWriteBehind(&writeBehind_);
+	if (!aio_.attach(&parent->aio_))
+		return false;
+#endif
 
 #ifdef IOBENCH_HAVE_URING
+	uring.setWriteBehind(&writeBehind_);
 	return uring.attach(&parent->uring);
 #else
 	return true;
 #endif
 }
+bool FileIOUnix::registerBuffers(const BufferArena *arena){
+#ifdef IOBENCH_HAVE_URING
+	// arena may serve as plain pool memory, without fixed buffers
+	if (!params_.fixedBufferBytes_)
+		return false;
+	return uring.registerBuffers(arena);
+#else
+	(void)arena;
+	return false;
+#endif
+}
+bool FileIOUnix::setCompletionReaper(CompletionReaper *reaper){
+#ifdef IOBENCH_HAVE_URING
+	return uring.setCompletionReaper(reaper);
+#else
+	(void)reaper;
+	return false;
+#endif
+}
+void FileIOUnix::setWriteOffloader(WriteOffloader *offloader){
+	offloader_ = offloader;
+}
+// Route asynchronous writes through aggregator's ring, rather than
+// through a ring of our own. The owner of the file descriptor
+// attaches the aggregator's ring to the file
+bool FileIOUnix::attachRingAggregator(RingAggregator *aggregator){
+#ifdef IOBENCH_HAVE_URING
+	if (ownsFileDescriptor_ && !aggregator->attach(filename_, mode_, fd_))
+		return false;
+	aggregator_ = aggregator;
+
+	return true;
+#else
+	(void)aggregator;
+	return false;
+#endif
+}
 int FileIOUnix::getMode(std::string mode)
 {
 	int m = -1;
@@ -77,14 +202,39 @@ int FileIOUnix::getMode(std::string mode)
 		case 'a':
 			m = O_WRONLY | O_CREAT;
 			break;
+		// overwrite existing file in place
+		case 'o':
+			m = O_WRONLY | O_CREAT;
+#ifdef __linux__
+			if (mode[1] == 'd')
+				m |= O_DIRECT;
+#endif
+			break;
 		default:
 			printf("Bad mode %s\n", mode.c_str());
 			break;
 	}
+	// a shared writable mapping needs read access
+	if (m != -1 && mode[0] != 'r' && mode[1] == '+')
+		m = (m & ~O_WRONLY) | O_RDWR;
 
 	return m;
 }
-
+// attach asynchronous engine selected by I/O parameters
+bool FileIOUnix::attachAsynch(std::string name, std::string mode, int fd){
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	if (params_.linuxAio_)
+		return aio_.attach(mode, fd);
+#endif
+#ifdef IOBENCH_HAVE_URING
+	return uring.attach(name, mode, fd,0);
+#else
+	(void)name;
+	(void)mode;
+	(void)fd;
+	return true;
+#endif
+}
 bool FileIOUnix::open(std::string name, std::string mode, bool asynch)
 {
 	(void)asynch;
@@ -106,8 +256,8 @@ bool FileIOUnix::open(std::string name, std::string mode, bool asynch)
 #ifdef __APPLE__
 	if (mode[1] == 'd')
 		fcntl(fd, F_NOCACHE, 1);
-#elif defined(IOBENCH_HAVE_URING)
-	if (asynch && !uring.attach(name, mode, fd,0))
+#else
+	if (asynch && !attachAsynch(name, mode, fd))
 		return false;
 #endif
 	fd_ = fd;
@@ -119,13 +269,20 @@ bool FileIOUnix::open(std::string name, std::string mode, bool asynch)
 }
 bool FileIOUnix::close(void)
 {
+	bool asynchOk = waitForOffload();
 #ifdef IOBENCH_HAVE_URING
-	uring.close();
+	asynchOk = uring.close() && asynchOk;
+#endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	asynchOk = aio_.close() && asynchOk;
 #endif
+	asynchOk = writeBehind_.finish() && asynchOk;
+	// dirty pages of mapping are flushed before file is synced
+	asynchOk = mmap_.close() && asynchOk;
 	int rc = 0;
 	if (ownsFileDescriptor_) {
 		if(fd_ == invalid_fd)
-			return true;
+			return asynchOk;
 
 		if (flushOnClose_){
 			int fret = fsync(fd_);
@@ -138,7 +295,71 @@ bool FileIOUnix::close(void)
 	}
 	ownsFileDescriptor_ = false;
 
-	return rc == 0;
+	return asynchOk && rc == 0;
+}
+// Set file length to len. With preallocate, disk space for the whole file
+// is also reserved, so that concurrent writers do not contend on extent allocation
+bool FileIOUnix::allocate(uint64_t len, bool preallocate){
+	struct stat st;
+	if (fstat(fd_, &st) != 0){
+		printf("fstat: %s\n", strerror(errno));
+		return false;
+	}
+	// an overwritten file may be longer than this image
+	if ((uint64_t)st.st_size > len && ftruncate(fd_, (off_t)len) != 0){
+		printf("ftruncate: %s\n", strerror(errno));
+		return false;
+	}
+	if (!preallocate)
+		return true;
+#ifdef __APPLE__
+	printf("Preallocation not supported\n");
+	return false;
+#else
+#ifdef __linux__
+	if (fallocate(fd_, 0, 0, (off_t)len) == 0)
+		return true;
+	if (errno != EOPNOTSUPP){
+		printf("fallocate: %s\n", strerror(errno));
+		return false;
+	}
+#endif
+	// emulated by writing zeros if file system does not support fallocate
+	int ret = posix_fallocate(fd_, 0, (off_t)len);
+	if (ret){
+		printf("posix_fallocate: %s\n", strerror(ret));
+		return false;
+	}
+
+	return true;
+#endif
+}
+// size file to len and map it : pixel writes then go through the mapping
+bool FileIOUnix::map(uint64_t len){
+	return mmap_.map(fd_, len);
+}
+// buffer that wraps mapping at offset, or nullptr if file is not mapped
+IOBuf* FileIOUnix::getMappedBuffer(uint64_t offset, uint64_t len){
+	return mmap_.getBuffer(offset, len);
+}
+// stock request pool of the engine that writes, with count requests
+// of up to numBuffers buffers. Mapped writes need no request
+void FileIOUnix::prewarmRequests(uint32_t count, uint32_t numBuffers){
+	if (mmap_.active())
+		return;
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	if (aio_.active()) {
+		aio_.prewarmRequests(count, numBuffers);
+		return;
+	}
+#endif
+#ifdef IOBENCH_HAVE_URING
+	if (!aggregator_ && uring.active()) {
+		uring.prewarmRequests(count, numBuffers);
+		return;
+	}
+#endif
+	scheduleDataPool_.prewarm(count, numBuffers);
 }
 bool FileIOUnix::reopenAsBuffered(void){
 	if (mode_.length() >= 2 && mode_[1] == 'd'){
@@ -173,28 +394,187 @@ uint64_t FileIOUnix::seek(int64_t off, int32_t whence)
 uint64_t FileIOUnix::write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers){
 	if (!buffers || !numBuffers)
 		return 0;
-	uint64_t bytesWritten = 0;
+	if (mmap_.active())
+		return mmap_.write(offset, buffers, numBuffers);
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	if (aio_.active())
+		return aio_.write(offset, buffers, numBuffers);
+#endif
+#ifdef IOBENCH_HAVE_URING
+	if (aggregator_) {
+		// bytes are reported as written once they are queued
+		auto io = scheduleDataPool_.get(offset,buffers,numBuffers,FileIO::isDirect(mode_));
+		io->complete_ = aggregatedComplete;
+		io->completeUserData_ = this;
+		{
+			std::lock_guard<std::mutex> lock(offloadMutex_);
+			offloadPending_++;
+		}
+		// aggregator's queue is full : wait for it to drain
+		while (!aggregator_->push(threadId_, io)) {
+			stats_.waits_++;
+			std::this_thread::yield();
+		}
+
+		return FileIO::bytesToWrite(buffers, numBuffers, mode_);
+	}
+#endif
 #ifdef IOBENCH_HAVE_URING
 	if (uring.active())
 		return uring.write(offset, buffers, numBuffers);
 #endif
 
-	auto io = new IOScheduleData(offset,buffers,numBuffers,FileIO::isDirect(mode_));
-	ssize_t writtenInCall = 0;
-	for(; bytesWritten < io->totalBytes_; bytesWritten += (uint64_t)writtenInCall)
-	{
-		writtenInCall = pwritev(fd_, (const iovec*)io->iov_, (int32_t)numBuffers, (int64_t)offset);
-		if(writtenInCall <= 0)
-			break;
+	auto io = scheduleDataPool_.get(offset,buffers,numBuffers,FileIO::isDirect(mode_));
+	io->enqueueTime_ = nowNs();
+	stats_.writes_++;
+	IOScheduleOp op;
+	op.init(io);
+	uint64_t total = op.remaining();
+	// with dedicated I/O threads, every write is handed over
+	int err = EAGAIN;
+	if (!offloader_ || !params_.ioThreads_)
+		err = writev(op, offloader_ && noWaitSupported_, stats_);
+	if (err == EAGAIN && offloader_) {
+		// write would block : hand remainder to an offload thread.
+		// Bytes are reported as written once they are queued.
+		stats_.offloads_++;
+		io->initOps(false, false, false);
+		io->ops_[0] = op;
+		{
+			std::lock_guard<std::mutex> lock(offloadMutex_);
+			offloadPending_++;
+		}
+		// I/O thread queue is full : wait for it to drain
+		while (!offloader_->push(this, io)) {
+			stats_.waits_++;
+			std::this_thread::yield();
+		}
+
+		return total;
 	}
-	delete io;
-	for (uint32_t i = 0; i < numBuffers; ++i){
-		auto b = buffers[i];
+	if (offloader_ && noWaitSupported_ && !err)
+		stats_.noWaitHits_++;
+	reclaim(io, &stats_);
+
+	return total - op.remaining();
+}
+// called by offload thread
+void FileIOUnix::finishOffload(IOScheduleData *io){
+	IOStats stats;
+	int err = writev(io->ops_[0], false, stats);
+	reclaim(io, &stats);
+	// notify under lock : once waitForOffload sees no pending write,
+	// this file, and its condition variable, may be destroyed
+	std::lock_guard<std::mutex> lock(offloadMutex_);
+	offloadStats_.add(stats);
+	if (err)
+		offloadFailed_ = true;
+	offloadPending_--;
+	offloadCv_.notify_all();
+}
+// called by aggregator thread once an aggregated write is complete
+void FileIOUnix::aggregatedComplete(IOScheduleData *io, void* user_data){
+	auto file = (FileIOUnix*)user_data;
+	bool failed = io->failed_;
+	file->reclaim(io, nullptr);
+	// notify under lock, as in finishOffload
+	std::lock_guard<std::mutex> lock(file->offloadMutex_);
+	if (failed)
+		file->offloadFailed_ = true;
+	file->offloadPending_--;
+	file->offloadCv_.notify_all();
+}
+// wait for offloaded or aggregated writes to complete.
+// Returns false if any of them failed
+bool FileIOUnix::waitForOffload(void){
+	std::unique_lock<std::mutex> lock(offloadMutex_);
+	offloadCv_.wait(lock, [this] { return offloadPending_ == 0; });
+	bool rc = !offloadFailed_;
+	offloadFailed_ = false;
+
+	return rc;
+}
+// stats may be null if reclaim latency is recorded by another engine
+void FileIOUnix::reclaim(IOScheduleData *io, IOStats *stats){
+	for (uint32_t i = 0; i < io->numBuffers_; ++i){
+		auto b = io->buffers_[i];
 		assert(reclaim_callback_);
 		reclaim_callback_(threadId_,b, reclaim_user_data_);
 	}
+	if (stats)
+		stats->addReclaim(nowNs() - io->enqueueTime_);
+	writeBehind_.written(io->offset_, io->totalBytes_);
+	scheduleDataPool_.put(io);
+}
+// Write remainder of operation, in calls of at most IOV_MAX iovecs.
+// After a short write, the next call resumes at the first unwritten byte.
+// With noWait, writes are issued with RWF_NOWAIT, and EAGAIN is returned
+// as soon as a write would block. Returns 0 on success, otherwise errno.
+int FileIOUnix::writev(IOScheduleOp &op, bool noWait, IOStats &stats){
+	auto io = op.data_;
+	// O_DIRECT transfers must stay aligned
+	uint64_t maxBytes = params_.maxWriteBytes_;
+	if (maxBytes && FileIO::isDirect(mode_))
+		maxBytes = std::max<uint64_t>((maxBytes / params_.alignment_) * params_.alignment_,
+										params_.alignment_);
+	while (op.numBuffers_) {
+		auto v = io->iov_ + op.firstBuffer_;
+		uint32_t count = std::min<uint32_t>(op.numBuffers_, IOV_MAX);
+		// trim call to maxBytes, and restore trimmed iovec afterwards
+		struct io *trimmed = nullptr;
+		size_t trimmedLen = 0;
+		uint64_t callBytes = 0;
+		for (uint32_t i = 0; i < count; ++i){
+			if (maxBytes && callBytes + v[i].iov_len >= maxBytes){
+				trimmed = v + i;
+				trimmedLen = trimmed->iov_len;
+				trimmed->iov_len = maxBytes - callBytes;
+				callBytes = maxBytes;
+				count = i + 1;
+				break;
+			}
+			callBytes += v[i].iov_len;
+		}
+		stats.submits_++;
+		ssize_t writtenInCall;
+#ifdef RWF_NOWAIT
+		if (noWait)
+			writtenInCall = pwritev2(fd_, (const iovec*)v, (int32_t)count,
+										(int64_t)op.offset_, RWF_NOWAIT);
+		else
+#endif
+			writtenInCall = pwritev(fd_, (const iovec*)v, (int32_t)count, (int64_t)op.offset_);
+		int err = writtenInCall < 0 ? errno : 0;
+		if (trimmed)
+			trimmed->iov_len = trimmedLen;
+		if (err == EAGAIN && noWait)
+			return EAGAIN;
+		if (err == EOPNOTSUPP && noWait) {
+			// i.e. buffered RWF_NOWAIT writes on older kernels
+			static std::atomic<bool> warned(false);
+			if (!warned.exchange(true))
+				printf("RWF_NOWAIT writes not supported - falling back to blocking writes\n");
+			noWaitSupported_ = false;
+			noWait = false;
+			continue;
+		}
+		if (err == EINTR || err == EAGAIN){
+			stats.retries_++;
+			continue;
+		}
+		if(writtenInCall <= 0) {
+			printf("pwritev of %lu bytes at offset %lu failed with error:\n%s\n",
+					op.remaining(), op.offset_,
+					err ? strerror(err) : "no bytes written");
+			stats.errors_++;
+			return err ? err : EIO;
+		}
+		op.advance((uint64_t)writtenInCall);
+		if ((uint64_t)writtenInCall < callBytes)
+			stats.retries_++;
+	}
 
-	return bytesWritten;
+	return 0;
 }
 uint64_t FileIOUnix::write(uint8_t* buf, uint64_t bytes_total)
 {
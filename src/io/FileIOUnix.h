@@ -18,37 +18,81 @@
 #pragma once
 
 #include <cstdint>
+#include <mutex>
+#include <condition_variable>
 
 #include "config.h"
 #include "FileIO.h"
 #include "FileIOUring.h"
+#include "FileIOMmap.h"
+#include "FileIOAio.h"
 #include "BufferPool.h"
+#include "WriteBehind.h"
+#include "IOScheduleDataPool.h"
 
 
 #ifndef _WIN32
 
 namespace io {
 
+class CompletionReaper;
+class WriteOffloader;
+class RingAggregator;
+
 class FileIOUnix : public FileIO
 {
 public:
 	FileIOUnix(uint32_t threadId, bool flushOnClose);
 	~FileIOUnix(void);
 	void registerReclaimCallback(io_callback reclaim_callback, void* user_data) override;
+	void setIOParams(const IOParams &params) override;
+	IOStats getStats(void) const override;
+	bool flush(void);
+	bool poll(void);
 	bool attach(FileIOUnix* parent);
+	bool registerBuffers(const BufferArena *arena);
+	bool setCompletionReaper(CompletionReaper *reaper);
+	void setWriteOffloader(WriteOffloader *offloader);
+	bool attachRingAggregator(RingAggregator *aggregator);
 	bool open(std::string name, std::string mode, bool asynch);
+	bool allocate(uint64_t len, bool preallocate);
+	bool map(uint64_t len);
+	IOBuf* getMappedBuffer(uint64_t offset, uint64_t len);
+	void prewarmRequests(uint32_t count, uint32_t numBuffers);
 	bool reopenAsBuffered(void);
 	bool close(void) override;
 	uint64_t write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers) override;
 	uint64_t write(uint8_t* buf, uint64_t size);
 	uint64_t seek(int64_t off, int32_t whence);
 private:
+	friend class WriteOffloader;
 #ifdef IOBENCH_HAVE_URING
 	FileIOUring uring;
 #endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	FileIOAio aio_;
+#endif
+	FileIOMmap mmap_;
 	int getMode(std::string mode);
+	bool attachAsynch(std::string name, std::string mode, int fd);
+	int writev(IOScheduleOp &op, bool noWait, IOStats &stats);
+	void finishOffload(IOScheduleData *io);
+	static void aggregatedComplete(IOScheduleData *io, void* user_data);
+	void reclaim(IOScheduleData *io, IOStats *stats);
+	bool waitForOffload(void);
 	int fd_;
 	bool ownsFileDescriptor_;
+	WriteOffloader *offloader_;
+	RingAggregator *aggregator_;
+	WriteBehind writeBehind_;
+	IOScheduleDataPool scheduleDataPool_;
+	bool noWaitSupported_;
+	// offloaded or aggregated writes in flight, and statistics of offloaded writes
+	uint32_t offloadPending_;
+	bool offloadFailed_;
+	IOStats offloadStats_;
+	mutable std::mutex offloadMutex_;
+	std::condition_variable offloadCv_;
 };
 
 
@@ -22,15 +22,23 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <cerrno>
 #include <cassert>
+#include <algorithm>
 
 #include "FileIOUring.h"
 #include "FileIO.h"
+#include "CompletionReaper.h"
+#include "util.h"
 
 namespace io {
 
 FileIOUring::FileIOUring(uint32_t threadId)
 	: fd_(-1), ownsDescriptor(false), requestsSubmitted(0), requestsCompleted(0),
+	  fixedBuffers_(false), fixedFile_(false), queuedOps_(0), queuedBytes_(0),
+	  depthLimit_(0), latency_(0), minLatency_(0), completionsSinceAdapt_(0),
+	  reaper_(nullptr), eventFd_(-1), retryPending_(false), failed_(false),
+	  writeBehind_(nullptr),
 	  reclaim_callback_(nullptr), reclaim_user_data_(nullptr),
 	  threadId_(threadId)
 {
@@ -44,12 +52,21 @@ FileIOUring::~FileIOUring()
 bool FileIOUring::active(void) const{
 	return ring.ring_fd != 0;
 }
+void FileIOUring::prewarmRequests(uint32_t count, uint32_t numBuffers){
+	scheduleDataPool_.prewarm(count, numBuffers);
+}
+const IOStats& FileIOUring::getStats(void) const{
+	return stats_;
+}
 void FileIOUring::registerReclaimCallback(io_callback reclaim_callback,
 												  void* user_data)
 {
 	reclaim_callback_ = reclaim_callback;
 	reclaim_user_data_ = user_data;
 }
+void FileIOUring::setIOParams(const IOParams &params){
+	params_ = params;
+}
 bool FileIOUring::attach(std::string fileName, std::string mode, int fd, uint32_t shared_ring_fd)
 {
 	fileName_ = fileName;
@@ -58,71 +75,379 @@ bool FileIOUring::attach(std::string fileName, std::string mode, int fd, uint32_
 	fd_ = fd;
 	ownsDescriptor = false;
 
-	return (doRead ? true : initQueue(shared_ring_fd));
+	if (doRead)
+		return true;
+	if (!initQueue(shared_ring_fd))
+		return false;
+	// kernels before 5.11 only accept registered files in SQPOLL mode
+	if (params_.registeredFile_ || params_.sqPoll_)
+		registerFile();
+
+	return true;
 }
 
 bool FileIOUring::attach(const FileIOUring *parent){
 	if (!parent->active())
 		return true;
+	params_ = parent->params_;
 	return attach(parent->fileName_, parent->mode_, parent->fd_,(uint32_t)parent->ring.ring_fd);
 }
 
+bool FileIOUring::registerFile(void){
+	int ret = io_uring_register_files(&ring, &fd_, 1);
+	if (ret < 0){
+		printf("io_uring_register_files: %s\n", strerror(-ret));
+		return false;
+	}
+	fixedFile_ = true;
+
+	return true;
+}
+bool FileIOUring::registerBuffers(const BufferArena *arena){
+	if (!active() || !arena || !arena->valid())
+		return false;
+	int ret = io_uring_register_buffers(&ring,
+										(const iovec*)arena->regions(),
+										arena->numRegions());
+	if (ret < 0){
+		printf("io_uring_register_buffers: %s\n", strerror(-ret));
+		return false;
+	}
+	fixedBuffers_ = true;
+
+	return true;
+}
+
+bool FileIOUring::setCompletionReaper(CompletionReaper *reaper){
+	if (!active() || !reaper)
+		return false;
+	if (!reaper->add(this))
+		return false;
+	reaper_ = reaper;
+
+	return true;
+}
+
+void FileIOUring::setWriteBehind(WriteBehind *writeBehind){
+	writeBehind_ = writeBehind;
+}
+
 bool FileIOUring::initQueue(uint32_t shared_ring_fd)
 {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
 	if (shared_ring_fd){
-		struct io_uring_params p;
-		memset(&p, 0, sizeof(p));
 		p.flags = IORING_SETUP_ATTACH_WQ;
 		p.wq_fd = shared_ring_fd;
-		int ret = io_uring_queue_init_params(QD, &ring, &p);
-		if (ret < 0) {
-			printf("io_uring_queue_init_params: %s\n", strerror(-ret));
-			close();
-			return false;
-		}
-
-	} else {
-		int ret = io_uring_queue_init(QD, &ring, 0);
-		if(ret < 0)
-		{
-			printf("io_uring_queue_init: %s\n", strerror(-ret));
-			close();
-			return false;
+	}
+	if (params_.sqPoll_){
+		// a SQPOLL ring attached to a SQPOLL parent shares the parent's
+		// kernel poller thread, so idle time and cpu are set by the parent
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = params_.sqPollIdle_;
+		if (!shared_ring_fd && params_.sqPollCpu_ >= 0){
+			p.flags |= IORING_SETUP_SQ_AFF;
+			p.sq_thread_cpu = (uint32_t)params_.sqPollCpu_;
 		}
 	}
+	uint32_t queueDepth = std::max<uint32_t>(params_.queueDepth_, 1);
+	if (params_.completionQueueSize_){
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = std::max(params_.completionQueueSize_, queueDepth);
+	}
+	int ret = io_uring_queue_init_params(queueDepth, &ring, &p);
+	if (ret < 0) {
+		printf("io_uring_queue_init_params: %s\n", strerror(-ret));
+		close();
+		return false;
+	}
+	// kernel may round queue sizes up, but never keep more operations
+	// in flight than the completion queue can hold
+	params_.queueDepth_ = std::min(queueDepth, p.cq_entries);
+	depthLimit_ = params_.queueDepth_;
 
 	return true;
 }
 
-void FileIOUring::enqueue(io_uring* ring, IOScheduleData* data, bool readop, int fd)
+// newOp is false when reissuing an operation that is still counted as in flight
+io_uring_sqe* FileIOUring::getSqe(io_uring* ring, bool newOp)
 {
+	// back pressure : block on completions while ring is at full depth
+	while (newOp && requestsSubmitted - requestsCompleted >= depthLimit_) {
+		stats_.waits_++;
+		if (queuedOps_)
+			submit(ring);
+		if (reaper_)
+			waitForReaper(depthLimit_ - 1);
+		else if (!processCompletion(false, false))
+			break;
+	}
 	auto sqe = io_uring_get_sqe(ring);
-	assert(sqe);
-	if(readop)
-		io_uring_prep_readv(sqe, fd, (const iovec*)data->iov_, data->numBuffers_, data->offset_);
+	while (!sqe) {
+		// submission queue is full : hand pending entries to the kernel.
+		// In SQPOLL mode, entries are consumed by the poller thread,
+		// so we may also have to wait for it to make room.
+		submit(ring);
+		io_uring_sqring_wait(ring);
+		sqe = io_uring_get_sqe(ring);
+	}
+	queuedOps_++;
+	if (newOp)
+		requestsSubmitted++;
+
+	return sqe;
+}
+
+void FileIOUring::prepOp(io_uring_sqe *sqe, IOScheduleOp *op)
+{
+	// registered file is always at index 0
+	int fd = fixedFile_ ? 0 : fd_;
+	auto v = op->data_->iov_ + op->firstBuffer_;
+	if (op->fixed_)
+		io_uring_prep_write_fixed(sqe, fd, v->iov_base, (unsigned)v->iov_len, op->offset_,
+									(int)op->data_->buffers_[op->firstBuffer_]->index_);
+	else if (op->read_)
+		io_uring_prep_readv(sqe, fd, (const iovec*)v, op->numBuffers_, op->offset_);
 	else
-		io_uring_prep_writev(sqe, fd, (const iovec*)data->iov_, data->numBuffers_, data->offset_);
-	io_uring_sqe_set_data(sqe, data);
-	int ret = io_uring_submit(ring);
-	assert(ret == 1);
-	(void)(ret);
-	requestsSubmitted++;
+		io_uring_prep_writev(sqe, fd, (const iovec*)v, op->numBuffers_, op->offset_);
+	io_uring_sqe_set_flags(sqe, fixedFile_ ? IOSQE_FIXED_FILE : 0);
+	io_uring_sqe_set_data(sqe, op);
+}
 
-	while(true)
-	{
-		bool success;
-		auto data = retrieveCompletion(true, success);
-		if(!success || !data)
+void FileIOUring::enqueue(io_uring* ring, IOScheduleData* data, bool readop)
+{
+	if (retryPending_) {
+		std::unique_lock<std::mutex> lock(completionMutex_);
+		reissueQueued(lock);
+	}
+	data->enqueueTime_ = nowNs();
+	// fixed writes are only possible if every buffer is registered
+	bool fixed = !readop && fixedBuffers_;
+	for (uint32_t i = 0; i < data->numBuffers_ && fixed; ++i)
+		fixed = data->buffers_[i]->registered();
+	// WRITE_FIXED is not vectored, so issue one operation per buffer
+	data->initOps(fixed, fixed, readop);
+	for (uint32_t i = 0; i < data->numOps_; ++i)
+		prepOp(getSqe(ring, true), data->ops_ + i);
+	queuedBytes_ += data->totalBytes_;
+	stats_.writes_++;
+	bool doSubmit = (params_.batchOps_ && queuedOps_ >= params_.batchOps_) ||
+						(params_.batchBytes_ && queuedBytes_ >= params_.batchBytes_);
+	if (doSubmit) {
+		int ret = submit(ring);
+		assert(ret >= 0);
+		(void)(ret);
+	}
+
+	if (!reaper_)
+		while(processCompletion(true, false));
+}
+
+// called by reaper thread : process all available completions
+uint32_t FileIOUring::reap(void)
+{
+	uint32_t count = 0;
+	while(processCompletion(true, false))
+		count++;
+	if (count) {
+		// lock ensures that a waiting writer does not miss the notification
+		{
+			std::lock_guard<std::mutex> lock(completionMutex_);
+		}
+		completionCv_.notify_all();
+	}
+
+	return count;
+}
+
+// block until reaper thread has brought number of operations
+// in flight down to maxInFlight, reissuing any incomplete operations
+// that it hands back
+void FileIOUring::waitForReaper(size_t maxInFlight)
+{
+	std::unique_lock<std::mutex> lock(completionMutex_);
+	while (true) {
+		completionCv_.wait(lock, [this, maxInFlight] {
+			return !retryOps_.empty() ||
+					requestsSubmitted - requestsCompleted <= maxInFlight;
+		});
+		if (retryOps_.empty())
 			break;
-		for (uint32_t i = 0; i < data->numBuffers_; ++i){
-			auto b = data->buffers_[i];
+		reissueQueued(lock);
+	}
+}
+
+// called by writer thread with completionMutex_ held
+void FileIOUring::reissueQueued(std::unique_lock<std::mutex> &lock)
+{
+	if (retryOps_.empty())
+		return;
+	std::vector<IOScheduleOp*> ops;
+	ops.swap(retryOps_);
+	retryPending_ = false;
+	lock.unlock();
+	for (auto op : ops)
+		prepOp(getSqe(&ring, false), op);
+	submit(&ring);
+	lock.lock();
+}
+
+// retrieve a completion, and reclaim buffers if its request is complete.
+// When closing, buffers are released rather than recycled.
+// Returns false if there was no completion.
+bool FileIOUring::processCompletion(bool peek, bool closing)
+{
+	bool success;
+	int32_t res = 0;
+	auto op = retrieveCompletion(peek, success, res);
+	if(!success || !op)
+		return false;
+	if (!finishOp(op, res))
+		return true;
+	requestsCompleted++;
+	auto data = op->data_;
+	if (--data->pendingOps_)
+		return true;
+	uint64_t latency = nowNs() - data->enqueueTime_;
+	stats_.addReclaim(latency);
+	if (params_.adaptiveDepth_ && !closing)
+		adaptDepth(latency);
+	if (writeBehind_)
+		writeBehind_->written(data->offset_, data->totalBytes_);
+	if (data->complete_) {
+		data->complete_(data, data->completeUserData_);
+		return true;
+	}
+	for (uint32_t i = 0; i < data->numBuffers_; ++i){
+		auto b = data->buffers_[i];
+		if (closing)
+			RefReaper::unref(b);
+		else
 			reclaim_callback_(threadId_, b, reclaim_user_data_);
+	}
+	scheduleDataPool_.put(data);
+
+	return true;
+}
+
+// Check result of a completed operation.
+// Returns true if operation is finished, either because all of its bytes
+// were transferred, or because it failed. Otherwise, the operation is
+// reissued for the remainder of its bytes.
+bool FileIOUring::finishOp(IOScheduleOp *op, int32_t res)
+{
+	uint64_t remaining = op->remaining();
+	if (res >= 0 && (uint64_t)res >= remaining)
+		return true;
+	if (res == 0 && op->read_)
+		return true;
+	int err = 0;
+	if (res == 0)
+		err = EIO;
+	else if (res < 0 && res != -EAGAIN && res != -EINTR)
+		err = -res;
+	else if (op->retries_ == maxOpRetries)
+		err = res < 0 ? -res : EIO;
+	if (err) {
+		printf("Asynchronous %s of %lu bytes at offset %lu failed with error:\n%s\n",
+				op->read_ ? "read" : "write", remaining, op->offset_, strerror(err));
+		stats_.errors_++;
+		failed_ = true;
+		op->data_->failed_ = true;
+		return true;
+	}
+	if (res > 0)
+		op->advance((uint64_t)res);
+	op->retries_++;
+	stats_.retries_++;
+	reissue(op);
+
+	return false;
+}
+
+void FileIOUring::reissue(IOScheduleOp *op)
+{
+	if (reaper_) {
+		// only the writer thread may add entries to the submission queue
+		{
+			std::lock_guard<std::mutex> lock(completionMutex_);
+			retryOps_.push_back(op);
+			retryPending_ = true;
 		}
-		delete data;
+		completionCv_.notify_all();
+		return;
 	}
+	prepOp(getSqe(&ring, false), op);
+	submit(&ring);
+}
+
+// Shrink depth when latency climbs well above the best latency seen so far,
+// since extra depth is then only queueing in the device. Grow depth again
+// while latency stays close to the best.
+void FileIOUring::adaptDepth(uint64_t latency)
+{
+	latency_ = latency_ ? (7 * latency_ + latency) / 8 : latency;
+	if (!minLatency_ || latency_ < minLatency_)
+		minLatency_ = latency_;
+	if (++completionsSinceAdapt_ < depthLimit_)
+		return;
+	completionsSinceAdapt_ = 0;
+	if (latency_ > 2 * minLatency_)
+		depthLimit_ = std::max<uint32_t>(depthLimit_ / 2, 1);
+	else if (2 * latency_ < 3 * minLatency_ && depthLimit_ < params_.queueDepth_)
+		depthLimit_++;
+}
+
+// true if io_uring_submit will enter the kernel. With SQPOLL, the poller
+// thread picks up queued entries by itself, and the kernel is only entered
+// to wake the thread once it has gone idle, or to flush completions that
+// overflowed the completion queue. The flags are read before submitting,
+// so a poller that goes idle in between is missed
+static bool submitEnters(io_uring* ring)
+{
+	if (!io_uring_sq_ready(ring))
+		return false;
+	if (!(ring->flags & IORING_SETUP_SQPOLL))
+		return true;
+	unsigned flags = __atomic_load_n(ring->sq.kflags, __ATOMIC_ACQUIRE);
+
+	return (flags & (IORING_SQ_NEED_WAKEUP | IORING_SQ_CQ_OVERFLOW)) != 0;
+}
+
+int FileIOUring::submit(io_uring* ring)
+{
+	if (submitEnters(ring))
+		stats_.submits_++;
+	int ret = io_uring_submit(ring);
+	queuedOps_ = 0;
+	queuedBytes_ = 0;
+
+	return ret;
+}
+
+bool FileIOUring::flush(void)
+{
+	if (!active() || !queuedOps_)
+		return true;
+
+	return submit(&ring) >= 0;
 }
 
-IOScheduleData* FileIOUring::retrieveCompletion(bool peek, bool& success)
+// submit queued writes, and reclaim buffers of completed writes
+// without blocking, unless a reaper thread owns the completion queue
+bool FileIOUring::poll(void)
+{
+	if (!flush())
+		return false;
+	if (active() && !reaper_)
+		reap();
+
+	return true;
+}
+
+// retrieve a completion, and store the result of its operation in res.
+// Returns nullptr if there was no completion.
+IOScheduleOp* FileIOUring::retrieveCompletion(bool peek, bool& success, int32_t &res)
 {
 	io_uring_cqe* cqe;
 	int ret;
@@ -137,27 +462,16 @@ IOScheduleData* FileIOUring::retrieveCompletion(bool peek, bool& success)
 	{
 		if(!peek)
 		{
-			printf("io_uring_wait_cqe returned an error.");
+			printf("io_uring_wait_cqe: %s\n", strerror(-ret));
 			success = false;
 		}
 		return nullptr;
 	}
-	if(cqe->res < 0)
-	{
-		printf("Asynchronous system call failed with error:\n%s\n",
-					  strerror(cqe->res));
-		success = false;
-		return nullptr;
-	}
-
-	auto data = (IOScheduleData*)io_uring_cqe_get_data(cqe);
-	if(data)
-	{
-		io_uring_cqe_seen(&ring, cqe);
-		requestsCompleted++;
-	}
+	auto op = (IOScheduleOp*)io_uring_cqe_get_data(cqe);
+	res = cqe->res;
+	io_uring_cqe_seen(&ring, cqe);
 
-	return data;
+	return op;
 }
 
 bool FileIOUring::close(void)
@@ -166,42 +480,69 @@ bool FileIOUring::close(void)
 		return true;
 	if(ring.ring_fd)
 	{
-		// process pending requests
-		size_t count = requestsSubmitted - requestsCompleted;
-		for(uint32_t i = 0; i < count; ++i)
-		{
-			bool success;
-			auto data = retrieveCompletion(false, success);
-			if(!success)
+		// submit queued requests, then wait for all pending requests
+		flush();
+		if (reaper_){
+			// reaper reclaims buffers of all pending requests
+			waitForReaper(0);
+			reaper_->remove(this);
+			reaper_ = nullptr;
+		}
+		while(requestsSubmitted != requestsCompleted) {
+			if (!processCompletion(false, true))
 				break;
-			if(data)
-			{
-				for (uint32_t j = 0; j < data->numBuffers_; ++j)
-					RefReaper::unref(data->buffers_[j]);
-				delete data;
-			}
 		}
 		io_uring_queue_exit(&ring);
 		memset(&ring, 0, sizeof(ring));
 	}
 	requestsSubmitted = 0;
 	requestsCompleted = 0;
-	bool rc = !ownsDescriptor || (fd_ != -1 && ::close(fd_) == 0);
+	fixedBuffers_ = false;
+	fixedFile_ = false;
+	depthLimit_ = 0;
+	latency_ = 0;
+	minLatency_ = 0;
+	completionsSinceAdapt_ = 0;
+	bool rc = !failed_;
+	failed_ = false;
+	rc &= !ownsDescriptor || (fd_ != -1 && ::close(fd_) == 0);
 	fd_ = -1;
 	ownsDescriptor = false;
 
 	return rc;
 }
 
+// issue a request handed over by another thread, with a completion callback
+void FileIOUring::issue(IOScheduleData* data)
+{
+	assert(data->complete_);
+	if (failed_) {
+		data->failed_ = true;
+		data->complete_(data, data->completeUserData_);
+		return;
+	}
+	enqueue(&ring, data, false);
+}
+size_t FileIOUring::inFlight(void) const
+{
+	return requestsSubmitted - requestsCompleted;
+}
+
+// Bytes are reported as written once they are queued. A failed operation
+// is reported by all subsequent writes, and by close()
 uint64_t FileIOUring::write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers)
 {
-	auto data = new IOScheduleData(offset,buffers,numBuffers,FileIO::isDirect(mode_));
+	if (failed_) {
+		for (uint32_t i = 0; i < numBuffers; ++i)
+			reclaim_callback_(threadId_, buffers[i], reclaim_user_data_);
+		return 0;
+	}
+	auto data = scheduleDataPool_.get(offset,buffers,numBuffers,FileIO::isDirect(mode_));
 	uint64_t toWrite = FileIO::bytesToWrite(buffers, numBuffers, mode_);
-	enqueue(&ring, data, false, fd_);
+	enqueue(&ring, data, false);
 
 	return toWrite;
 }
-
 }
 
 #endif
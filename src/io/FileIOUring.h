@@ -22,13 +22,27 @@
 
 #include <liburing.h>
 #include <liburing/io_uring.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 #include "IFileIO.h"
+#include "BufferArena.h"
+#include "IOParams.h"
+#include "IOStats.h"
+#include "WriteBehind.h"
+#include "IOScheduleDataPool.h"
 
 namespace io {
 
+class CompletionReaper;
+class RingAggregator;
+
 class FileIOUring : public IFileIO
 {
+	friend class CompletionReaper;
+	friend class RingAggregator;
   public:
 	FileIOUring(uint32_t threadId);
 	virtual ~FileIOUring() override;
@@ -37,9 +51,17 @@ class FileIOUring : public IFileIO
 
 	// uring-specific
 	void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
+	void setIOParams(const IOParams &params);
 	bool attach(std::string fileName, std::string mode, int fd, uint32_t shared_ring_fd);
 	bool attach(const FileIOUring *parent);
+	bool registerBuffers(const BufferArena *arena);
+	bool setCompletionReaper(CompletionReaper *reaper);
+	void setWriteBehind(WriteBehind *writeBehind);
+	bool flush(void);
+	bool poll(void);
 	bool active(void) const;
+	void prewarmRequests(uint32_t count, uint32_t numBuffers);
+	const IOStats& getStats(void) const;
 
   private:
 	io_uring ring;
@@ -48,12 +70,51 @@ class FileIOUring : public IFileIO
 	std::string fileName_;
 	std::string mode_;
 	size_t requestsSubmitted;
-	size_t requestsCompleted;
-	void enqueue(io_uring* ring, IOScheduleData* data, bool readop, int fd);
+	// may be updated by reaper thread
+	std::atomic<size_t> requestsCompleted;
+	bool fixedBuffers_;
+	bool fixedFile_;
+	IOParams params_;
+	IOStats stats_;
+	// operations and bytes queued since last submit
+	uint32_t queuedOps_;
+	uint64_t queuedBytes_;
+	bool registerFile(void);
+	int submit(io_uring* ring);
+	void issue(IOScheduleData* data);
+	size_t inFlight(void) const;
+	void enqueue(io_uring* ring, IOScheduleData* data, bool readop);
+	io_uring_sqe* getSqe(io_uring* ring, bool newOp);
+	void prepOp(io_uring_sqe *sqe, IOScheduleOp *op);
 	bool initQueue(uint32_t shared_ring_fd);
-	IOScheduleData* retrieveCompletion(bool peek, bool& success);
+	IOScheduleOp* retrieveCompletion(bool peek, bool& success, int32_t &res);
+	bool processCompletion(bool peek, bool closing);
+	bool finishOp(IOScheduleOp *op, int32_t res);
+	void reissue(IOScheduleOp *op);
+	void reissueQueued(std::unique_lock<std::mutex> &lock);
+	void adaptDepth(uint64_t latency);
+	uint32_t reap(void);
+	void waitForReaper(size_t maxInFlight);
 
-	const uint32_t QD = 4;
+	// current limit on operations in flight, at most params_.queueDepth_
+	std::atomic<uint32_t> depthLimit_;
+	// smoothed and minimum request latency in ns, for adaptive depth
+	uint64_t latency_;
+	uint64_t minLatency_;
+	uint32_t completionsSinceAdapt_;
+	// when a reaper is set, completions are only consumed by the reaper thread
+	CompletionReaper *reaper_;
+	int eventFd_;
+	std::mutex completionMutex_;
+	std::condition_variable completionCv_;
+	// incomplete operations found by reaper thread, to be reissued
+	// by writer thread, which owns the submission queue
+	std::vector<IOScheduleOp*> retryOps_;
+	std::atomic<bool> retryPending_;
+	// set when an operation fails : file is incomplete
+	std::atomic<bool> failed_;
+	WriteBehind *writeBehind_;
+	IOScheduleDataPool scheduleDataPool_;
 	io_callback reclaim_callback_;
 	void* reclaim_user_data_;
 	uint32_t threadId_;
@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
 #ifdef _WIN32
 #include <malloc.h>
 #endif
@@ -30,10 +31,15 @@
 namespace io {
 
 #define K 1024
-#define ALIGNMENT (512)
-#define WRTSIZE (32*K)
+
+// O_DIRECT alignment and chunked write size, used when storage geometry
+// is not discovered. See StorageGeometry.h
+const uint64_t defaultAlignment = 512;
+const uint64_t defaultWriteSize = 32 * K;
 
 const int32_t invalid_fd = -1;
+// index_ of an IOBuf whose memory is not registered with the kernel
+const uint32_t unregistered_index = (uint32_t)-1;
 
 typedef struct _io_buf
 {
@@ -53,8 +59,8 @@ typedef void (*io_register_client_callback)(io_callback reclaim_callback,
 struct IOBuf : public io_buf, public RefCounted
 {
   public:
-	IOBuf() {
-		index_ = 0;
+	IOBuf() : numaNode_(-1), poolNext_(nullptr), ownsData_(true) {
+		index_ = unregistered_index;
 		skip_ = 0;
 		offset_ = 0;
 		data_ = 0;
@@ -66,33 +72,26 @@ struct IOBuf : public io_buf, public RefCounted
   		dealloc();
   	}
   public:
-	static bool isAlignedToWriteSize(uint64_t off){
-		return (off & (WRTSIZE-1)) == 0;
-	}
-	bool aligned(void){
-		return alignedOffset() && alignedLength();
-	}
-	bool alignedOffset(void){
-		return isAlignedToWriteSize(offset_);
-	}
-	bool alignedLength(void){
-		return isAlignedToWriteSize(len_);
-	}
 	static uint8_t* alignedAlloc(size_t alignment, size_t length){
 #ifdef _WIN32
 		return (uint8_t*)_aligned_malloc(length,alignment);
 #else
+		// aligned_alloc requires length to be a multiple of alignment
+		length = ((length + alignment - 1) / alignment) * alignment;
 		return (uint8_t*)std::aligned_alloc(alignment,length);
 #endif
 	}
-	bool alloc(uint64_t len)
+	bool registered(void) const{
+		return index_ != unregistered_index;
+	}
+	bool alloc(uint64_t len, uint64_t alignment)
 	{
 		if (len < allocLen_)
 			return true;
 
 		if (data_)
 			dealloc();
-		data_ = alignedAlloc(ALIGNMENT,len);
+		data_ = alignedAlloc(alignment,len);
 		if(data_)
 		{
 			len_ = len;
@@ -107,13 +106,34 @@ struct IOBuf : public io_buf, public RefCounted
 		if (data_ && len <= allocLen_)
 			len_ = len;
 	}
+	// wrap memory owned by someone else (i.e. a BufferArena).
+	// index is the registered index of the memory, if any.
+	void attach(uint8_t *data, uint64_t len, uint32_t index){
+		dealloc();
+		data_ = data;
+		len_ = len;
+		allocLen_ = len;
+		index_ = index;
+		ownsData_ = false;
+	}
 	void dealloc()
 	{
-		free(data_);
+		if (ownsData_)
+			free(data_);
 		data_ = nullptr;
 		len_ = 0;
 		allocLen_ = 0;
+		index_ = unregistered_index;
+		numaNode_ = -1;
+		ownsData_ = true;
 	}
+	// kernel node id of first page, sampled once by the BufferPool
+	// that allocated the buffer, or -1 if not sampled
+	int32_t numaNode_;
+	// next buffer in a BufferPool free list
+	IOBuf *poolNext_;
+  private:
+	bool ownsData_;
 };
 
 // mirror of iovec struct
@@ -122,14 +142,81 @@ struct io {
   size_t iov_len;
 };
 
+struct IOScheduleData;
+
+// called once a request issued on behalf of another thread is complete,
+// instead of reclaiming the request's buffers. Takes ownership of data
+typedef void (*io_complete_callback)(IOScheduleData *data, void* user_data);
+
+// maximum number of times an asynchronous operation is reissued
+// after a short or interrupted transfer
+const uint32_t maxOpRetries = 64;
+
+// An asynchronous operation, covering a run of a request's iovecs.
+// After a short transfer, the iovecs are advanced past the transferred
+// bytes, and the operation can be reissued for the remainder.
+struct IOScheduleOp
+{
+	IOScheduleData *data_;
+	uint32_t firstBuffer_;
+	uint32_t numBuffers_;
+	// file offset of first byte still to be transferred
+	uint64_t offset_;
+	// operation writes from a single registered buffer
+	bool fixed_;
+	bool read_;
+	// number of times operation has been reissued
+	uint32_t retries_;
+	// cover all buffers of a request
+	inline void init(IOScheduleData *data);
+	inline uint64_t remaining(void) const;
+	inline void advance(uint64_t bytes);
+};
+
+// Requests are recycled by an IOScheduleDataPool. Their arrays only grow,
+// at least doubling each time, so that recycled requests soon stop allocating
+// even though requests vary in their number of buffers.
 struct IOScheduleData
 {
-	IOScheduleData(uint64_t offset, IOBuf **buffers, uint32_t numBuffers, bool direct) :
-		offset_(offset) , numBuffers_(numBuffers),buffers_(nullptr),
-		iov_(new io[numBuffers_]), totalBytes_(0)
-	{
+	IOScheduleData() :
+		offset_(0) , numBuffers_(0),buffers_(nullptr),
+		iov_(nullptr), totalBytes_(0), pendingOps_(1), enqueueTime_(0),
+		ops_(nullptr), numOps_(0), failed_(false),
+		complete_(nullptr), completeUserData_(nullptr),
+		capacity_(0), opsCapacity_(0), poolNext_(nullptr)
+	{}
+	~IOScheduleData(){
+		delete[] buffers_;
+		delete[] iov_;
+		delete[] ops_;
+	}
+	// grow arrays to hold numBuffers buffers and numOps operations
+	void reserve(uint32_t numBuffers, uint32_t numOps){
+		if (numBuffers > capacity_){
+			delete[] buffers_;
+			delete[] iov_;
+			capacity_ = std::max(numBuffers, 2 * capacity_);
+			buffers_ = new IOBuf*[capacity_];
+			iov_ = new io[capacity_];
+		}
+		if (numOps > opsCapacity_){
+			delete[] ops_;
+			opsCapacity_ = std::max(numOps, 2 * opsCapacity_);
+			ops_ = new IOScheduleOp[opsCapacity_];
+		}
+	}
+	void init(uint64_t offset, IOBuf **buffers, uint32_t numBuffers, bool direct){
 		assert(numBuffers);
-		buffers_ = new IOBuf*[numBuffers];
+		reserve(numBuffers, 0);
+		offset_ = offset;
+		numBuffers_ = numBuffers;
+		totalBytes_ = 0;
+		pendingOps_ = 1;
+		enqueueTime_ = 0;
+		numOps_ = 0;
+		failed_ = false;
+		complete_ = nullptr;
+		completeUserData_ = nullptr;
 		for (uint32_t i = 0; i < numBuffers_; ++i){
 			buffers_[i] = buffers[i];
 			auto b = buffers_[i];
@@ -139,17 +226,78 @@ struct IOScheduleData
 			totalBytes_   += b->len_;
 		}
 	}
-	~IOScheduleData(){
-		delete[] buffers_;
-		delete[] iov_;
+	// split request into a single vectored operation, or into
+	// one operation per buffer
+	void initOps(bool perBuffer, bool fixed, bool read){
+		numOps_ = perBuffer ? numBuffers_ : 1;
+		reserve(0, numOps_);
+		uint64_t offset = offset_;
+		for (uint32_t i = 0; i < numOps_; ++i){
+			auto op = ops_ + i;
+			op->data_ = this;
+			op->firstBuffer_ = i;
+			op->numBuffers_ = perBuffer ? 1 : numBuffers_;
+			op->offset_ = offset;
+			op->fixed_ = fixed;
+			op->read_ = read;
+			op->retries_ = 0;
+			offset += op->remaining();
+		}
+		pendingOps_ = numOps_;
 	}
 	uint64_t offset_;
 	uint32_t numBuffers_;
 	IOBuf **buffers_;
 	io *iov_;
 	uint64_t totalBytes_;
+	// number of asynchronous operations still in flight for this request
+	uint32_t pendingOps_;
+	// time in ns when request was handed to the I/O engine
+	uint64_t enqueueTime_;
+	IOScheduleOp *ops_;
+	uint32_t numOps_;
+	// set when an operation of the request fails
+	bool failed_;
+	io_complete_callback complete_;
+	void* completeUserData_;
+	// length of buffers_ and iov_, and of ops_
+	uint32_t capacity_;
+	uint32_t opsCapacity_;
+	// next request in an IOScheduleDataPool free list
+	IOScheduleData *poolNext_;
 };
 
+void IOScheduleOp::init(IOScheduleData *data){
+	data_ = data;
+	firstBuffer_ = 0;
+	numBuffers_ = data->numBuffers_;
+	offset_ = data->offset_;
+	fixed_ = false;
+	read_ = false;
+	retries_ = 0;
+}
+uint64_t IOScheduleOp::remaining(void) const{
+	uint64_t bytes = 0;
+	for (uint32_t i = 0; i < numBuffers_; ++i)
+		bytes += data_->iov_[firstBuffer_ + i].iov_len;
+
+	return bytes;
+}
+void IOScheduleOp::advance(uint64_t bytes){
+	offset_ += bytes;
+	while (numBuffers_ && bytes){
+		auto v = data_->iov_ + firstBuffer_;
+		if (bytes < v->iov_len){
+			v->iov_base = (uint8_t*)v->iov_base + bytes;
+			v->iov_len -= bytes;
+			return;
+		}
+		bytes -= v->iov_len;
+		firstBuffer_++;
+		numBuffers_--;
+	}
+}
+
 class IFileIO
 {
   public:
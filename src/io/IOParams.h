@@ -0,0 +1,168 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+
+#include "IFileIO.h"
+
+namespace io {
+
+// how completions of asynchronous writes are reaped
+enum CompletionMode {
+	// writer peeks for completions after each submit
+	COMPLETION_INLINE,
+	// reaper thread per ring group sweeps its rings at a fixed interval
+	COMPLETION_REAPER,
+	// reaper thread per ring group sleeps on eventfds registered with its rings
+	COMPLETION_EVENTFD,
+	// reaper thread per ring group spins on its rings for a bounded time,
+	// then sleeps on eventfds
+	COMPLETION_BUSY_POLL
+};
+
+/*
+ * Tuning parameters for the I/O engines.
+ * Default values reproduce the plain behaviour of each engine.
+ */
+struct IOParams {
+	IOParams() : fixedBufferBytes_(0),
+				registeredFile_(false),
+				sqPoll_(false),
+				sqPollIdle_(0),
+				sqPollCpu_(-1),
+				batchOps_(1),
+				batchBytes_(0),
+				taskFlush_(false),
+				queueDepth_(32),
+				completionQueueSize_(0),
+				adaptiveDepth_(false),
+				completionMode_(COMPLETION_INLINE),
+				reaperGroupSize_(4),
+				reaperIntervalUs_(100),
+				busyPollUs_(50),
+				maxWriteBytes_(0),
+				noWaitThreads_(0),
+				ioThreads_(0),
+				preallocate_(false),
+				overwrite_(false),
+				writeBehindBytes_(0),
+				dropCache_(false),
+				alignment_(defaultAlignment),
+				writeSize_(defaultWriteSize),
+				mmap_(false),
+				linuxAio_(false),
+				ringAggregator_(false),
+				arenaBytes_(0),
+				hugePageBytes_(0),
+				lockArena_(false),
+				numa_(false),
+				memoryBudgetBytes_(0),
+				prewarm_(false)
+	{}
+	// bytes of pool memory registered with io_uring as fixed buffers.
+	// Zero disables fixed buffers.
+	uint64_t fixedBufferBytes_;
+	// register the output file descriptor with every io_uring ring
+	bool registeredFile_;
+	// submit through a kernel SQ poller thread, shared by all rings
+	bool sqPoll_;
+	// poller idle time in ms before it sleeps. Zero selects kernel default.
+	uint32_t sqPollIdle_;
+	// cpu to pin poller thread to, or -1 for no affinity
+	int32_t sqPollCpu_;
+	// io_uring submission is deferred until this many operations are queued.
+	// Zero disables the count threshold.
+	uint32_t batchOps_;
+	// io_uring submission is deferred until this many bytes are queued.
+	// Zero disables the byte threshold.
+	uint64_t batchBytes_;
+	// deferred io_uring submissions are flushed at the end of each
+	// pixel write, i.e. of each strip task
+	bool taskFlush_;
+	// submission queue size, and maximum number of operations
+	// in flight on a ring. Writers block on completions beyond this depth.
+	uint32_t queueDepth_;
+	// completion queue size. Zero selects kernel default of twice queue depth.
+	uint32_t completionQueueSize_;
+	// adapt the number of operations in flight to completion latency
+	bool adaptiveDepth_;
+	CompletionMode completionMode_;
+	// number of worker rings served by each reaper thread
+	uint32_t reaperGroupSize_;
+	// sweep interval of a COMPLETION_REAPER thread
+	uint32_t reaperIntervalUs_;
+	// how long a busy polling reaper spins without completions before sleeping
+	uint32_t busyPollUs_;
+	// largest transfer issued by a single synchronous write call.
+	// A non-zero value forces short writes, for testing. Zero disables the limit.
+	uint64_t maxWriteBytes_;
+	// synchronous writes are first tried with RWF_NOWAIT, and writes that
+	// would block are handed to this many offload threads. Zero disables.
+	uint32_t noWaitThreads_;
+	// all synchronous writes are handed to this many dedicated I/O threads,
+	// each queueing up to queueDepth_ writes. Overrides noWaitThreads_.
+	// Zero disables.
+	uint32_t ioThreads_;
+	// reserve disk space for the whole image before any pixels are written
+	bool preallocate_;
+	// reuse an existing output file, and its allocated extents,
+	// rather than truncating it
+	bool overwrite_;
+	// buffered mode only : writeback of each completed write is started at once,
+	// and each worker waits for writeback once more than this many bytes
+	// are under writeback. Zero disables write-behind.
+	uint64_t writeBehindBytes_;
+	// drop written pages from page cache once their writeback is complete
+	bool dropCache_;
+	// alignment of O_DIRECT buffer memory, file offsets and lengths
+	uint64_t alignment_;
+	// length of each chunk in chunked mode : a multiple of alignment_
+	uint64_t writeSize_;
+	// buffered mode only : write through a shared mapping of the output file.
+	// Strips are encoded straight into the mapping, and chunks are copied into it
+	bool mmap_;
+	// asynchronous writes use Linux native AIO rather than io_uring.
+	// queueDepth_ and batching parameters apply to both engines
+	bool linuxAio_;
+	// asynchronous writes of all workers are issued by a single submission
+	// thread, on a single ring, rather than on one ring per worker
+	bool ringAggregator_;
+	// bytes of pool memory carved from a single arena, whatever the engine.
+	// With fixed buffers, the arena holds at least fixedBufferBytes_.
+	// Zero disables the arena, unless fixed buffers are enabled.
+	uint64_t arenaBytes_;
+	// size of huge pages backing the arena : 2 MB or 1 GB on x86-64.
+	// hugetlb pages are preferred, with transparent huge pages as fallback.
+	// Zero backs the arena with regular heap memory.
+	uint64_t hugePageBytes_;
+	// lock arena in memory once it has been pre-faulted
+	bool lockArena_;
+	// group workers by NUMA node : each worker runs on the cpus of its node,
+	// its pool memory and arena are placed on that node, and each node has
+	// its own completion reapers and buffer depot
+	bool numa_;
+	// bytes of pool buffers that may be handed out at once : buffers being
+	// encoded, and buffers whose writes are in flight. Writers wait for
+	// buffers to be reclaimed before exceeding it. Zero disables the budget.
+	uint64_t memoryBudgetBytes_;
+	// stock worker pools, and touch their buffers, before encoding starts
+	bool prewarm_;
+};
+
+}
@@ -0,0 +1,79 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+#include "IFileIO.h"
+
+namespace io {
+
+/*
+ * Free list of requests, so that an I/O engine doesn't allocate
+ * a request for every write. Requests are put back by whichever thread
+ * completes them, i.e. a completion reaper or an offload thread.
+ */
+class IOScheduleDataPool
+{
+  public:
+	IOScheduleDataPool() : free_(nullptr)
+	{}
+	~IOScheduleDataPool(){
+		while (free_){
+			auto next = free_->poolNext_;
+			delete free_;
+			free_ = next;
+		}
+	}
+	IOScheduleData* get(uint64_t offset, IOBuf **buffers, uint32_t numBuffers, bool direct){
+		IOScheduleData *data = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (free_) {
+				data = free_;
+				free_ = free_->poolNext_;
+			}
+		}
+		if (!data)
+			data = new IOScheduleData();
+		data->poolNext_ = nullptr;
+		data->init(offset, buffers, numBuffers, direct);
+
+		return data;
+	}
+	// stock pool with count requests, each holding up to numBuffers buffers,
+	// and as many operations
+	void prewarm(uint32_t count, uint32_t numBuffers){
+		for (uint32_t i = 0; i < count; ++i){
+			auto data = new IOScheduleData();
+			data->reserve(numBuffers, numBuffers);
+			put(data);
+		}
+	}
+	void put(IOScheduleData *data){
+		std::lock_guard<std::mutex> lock(mutex_);
+		data->poolNext_ = free_;
+		free_ = data;
+	}
+  private:
+	std::mutex mutex_;
+	IOScheduleData *free_;
+};
+
+}
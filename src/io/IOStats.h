@@ -0,0 +1,191 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+namespace io {
+
+/*
+ * Counters collected by the I/O engines, for reporting by the benchmark
+ */
+struct IOStats {
+	IOStats() : writes_(0),
+				submits_(0),
+				waits_(0),
+				reclaims_(0),
+				reclaimNs_(0),
+				maxReclaimNs_(0),
+				retries_(0),
+				errors_(0),
+				noWaitHits_(0),
+				offloads_(0)
+	{}
+	void add(const IOStats &rhs){
+		writes_  += rhs.writes_;
+		submits_ += rhs.submits_;
+		waits_   += rhs.waits_;
+		reclaims_  += rhs.reclaims_;
+		reclaimNs_ += rhs.reclaimNs_;
+		maxReclaimNs_ = std::max(maxReclaimNs_, rhs.maxReclaimNs_);
+		retries_ += rhs.retries_;
+		errors_  += rhs.errors_;
+		noWaitHits_ += rhs.noWaitHits_;
+		offloads_   += rhs.offloads_;
+	}
+	void addReclaim(uint64_t ns){
+		reclaims_++;
+		reclaimNs_ += ns;
+		maxReclaimNs_ = std::max(maxReclaimNs_, ns);
+	}
+	// number of calls to IFileIO::write
+	uint64_t writes_;
+	// number of system calls used to issue the writes. With an SQ poller
+	// thread, only calls that wake the thread are counted
+	uint64_t submits_;
+	// number of times a writer blocked waiting for a completion
+	uint64_t waits_;
+	// number of requests whose buffers were reclaimed, and time from
+	// write to reclaim, summed over requests and maximum
+	uint64_t reclaims_;
+	uint64_t reclaimNs_;
+	uint64_t maxReclaimNs_;
+	// number of operations reissued after a short or interrupted transfer
+	uint64_t retries_;
+	// number of operations that failed
+	uint64_t errors_;
+	// number of synchronous writes completed by a RWF_NOWAIT write,
+	// and number handed to an offload thread because they would block
+	uint64_t noWaitHits_;
+	uint64_t offloads_;
+};
+
+/*
+ * Counters collected by buffer pools
+ */
+struct PoolStats {
+	PoolStats() : gets_(0),
+					hits_(0),
+					requestedBytes_(0),
+					servedBytes_(0),
+					depotGets_(0),
+					depotPuts_(0),
+					prewarmed_(0),
+					prewarmedBytes_(0),
+					prewarmNs_(0)
+	{}
+	void add(const PoolStats &rhs){
+		gets_ += rhs.gets_;
+		hits_ += rhs.hits_;
+		requestedBytes_ += rhs.requestedBytes_;
+		servedBytes_    += rhs.servedBytes_;
+		depotGets_ += rhs.depotGets_;
+		depotPuts_ += rhs.depotPuts_;
+		prewarmed_ += rhs.prewarmed_;
+		prewarmedBytes_ += rhs.prewarmedBytes_;
+		prewarmNs_ += rhs.prewarmNs_;
+	}
+	// number of buffer requests, and number served by a pooled buffer
+	uint64_t gets_;
+	uint64_t hits_;
+	// bytes requested, and bytes allocated to serve the requests :
+	// the difference is internal fragmentation
+	uint64_t requestedBytes_;
+	uint64_t servedBytes_;
+	// number of magazines taken from, and handed to, the shared depot
+	uint64_t depotGets_;
+	uint64_t depotPuts_;
+	// number of buffers, and bytes, stocked before encoding started,
+	// and time taken to allocate and touch them, summed over pools
+	uint64_t prewarmed_;
+	uint64_t prewarmedBytes_;
+	uint64_t prewarmNs_;
+};
+
+/*
+ * Counters collected by a buffer arena
+ */
+struct ArenaStats {
+	ArenaStats() : slots_(0),
+					served_(0),
+					hugeServed_(0),
+					hugePageBytes_(0),
+					transparent_(false),
+					locked_(false)
+	{}
+	void add(const ArenaStats &rhs){
+		slots_  += rhs.slots_;
+		served_ += rhs.served_;
+		hugeServed_ += rhs.hugeServed_;
+		hugePageBytes_ = std::max(hugePageBytes_, rhs.hugePageBytes_);
+		transparent_ = transparent_ || rhs.transparent_;
+		locked_ = locked_ || rhs.locked_;
+	}
+	// number of slots in arena, and number handed out as buffers
+	uint64_t slots_;
+	uint64_t served_;
+	// number of buffers served from huge pages
+	uint64_t hugeServed_;
+	// size of huge pages backing the arena, or zero for a heap arena
+	uint64_t hugePageBytes_;
+	// huge pages are transparent huge pages, rather than hugetlb pages
+	bool transparent_;
+	// arena is locked in memory
+	bool locked_;
+};
+
+/*
+ * Placement of written buffers relative to the NUMA node of their writer
+ */
+struct NumaStats {
+	NumaStats() : nodes_(0),
+					buffers_(0),
+					remote_(0)
+	{}
+	// number of nodes workers are spread over
+	uint32_t nodes_;
+	// number of buffers written, and number whose memory is on
+	// another node than the writer's
+	uint64_t buffers_;
+	uint64_t remote_;
+};
+
+/*
+ * Use of a memory budget
+ */
+struct BudgetStats {
+	BudgetStats() : budget_(0),
+					peakBytes_(0),
+					averageBytes_(0),
+					waits_(0),
+					waitNs_(0),
+					overruns_(0)
+	{}
+	uint64_t budget_;
+	// peak and time weighted average of bytes charged to budget
+	uint64_t peakBytes_;
+	uint64_t averageBytes_;
+	// number of times a writer waited for room, and total wait time
+	uint64_t waits_;
+	uint64_t waitNs_;
+	// number of waits that gave up, letting the writer exceed the budget
+	uint64_t overruns_;
+};
+
+}
@@ -16,11 +16,22 @@
 
 
 #include "ImageFormat.h"
+#include "CompletionReaper.h"
+#include "RingAggregator.h"
 
 #include <climits>
+#include <pthread.h>
+#include <thread>
+#include <algorithm>
 
 namespace io {
 
+// how long a writer waiting for memory budget sleeps between polls for
+// its own completions, and how long it waits without any buffer being
+// reclaimed before it exceeds the budget
+const uint64_t budgetPollUs = 100;
+const uint64_t budgetStallUs = 10000;
+
 ImageFormat::ImageFormat(bool flushOnClose, uint8_t *header, size_t headerLength) :
 							header_(header),
 							headerLength_(headerLength),
@@ -29,8 +40,20 @@ ImageFormat::ImageFormat(bool flushOnClose, uint8_t *header, size_t headerLength
 							imageStripper_(nullptr),
 							concurrency_(0),
 							workerSerializers_(nullptr),
+							workerChunkArrays_(nullptr),
 							numPixelWrites_(0),
-							maxPixelWrites_(0)
+							maxPixelWrites_(0),
+							chunked_(false),
+							numNodes_(1),
+							bufferArenas_(nullptr),
+							bufferDepots_(nullptr),
+							numaBuffers_(0),
+							numaRemote_(0),
+							memoryBudget_(nullptr),
+							numCompletionReapers_(0),
+							completionReapers_(nullptr),
+							writeOffloader_(nullptr),
+							ringAggregator_(nullptr)
 {}
 ImageFormat::~ImageFormat() {
 	close();
@@ -39,7 +62,29 @@ ImageFormat::~ImageFormat() {
 			delete workerSerializers_[i];
 		delete[] workerSerializers_;
 	}
+	delete[] workerChunkArrays_;
+#ifdef IOBENCH_HAVE_URING
+	for (uint32_t i = 0; i < numCompletionReapers_; ++i)
+		delete completionReapers_[i];
+	delete ringAggregator_;
+#endif
+	delete[] completionReapers_;
+	delete writeOffloader_;
 	delete imageStripper_;
+	serializer_.setBufferDepot(nullptr);
+	serializer_.setMemoryBudget(nullptr);
+	delete memoryBudget_;
+	if (bufferDepots_) {
+		for (uint32_t i = 0; i < numNodes_; ++i)
+			delete bufferDepots_[i];
+		delete[] bufferDepots_;
+	}
+	// pool buffers may be carved from an arena, so arenas are deleted last
+	if (bufferArenas_) {
+		for (uint32_t i = 0; i < numNodes_; ++i)
+			delete bufferArenas_[i];
+		delete[] bufferArenas_;
+	}
 }
 void ImageFormat::registerReclaimCallback(io_callback reclaim_callback, void* user_data){
 	serializer_.registerReclaimCallback(reclaim_callback,user_data);
@@ -51,14 +96,78 @@ void ImageFormat::registerReclaimCallback(io_callback reclaim_callback, void* us
 void ImageFormat::setEncodeFinisher(std::function<bool(void)> finisher){
 	encodeFinisher_ = finisher;
 }
+// must be called before init, since chunks are allocated from the
+// serializer's pool, with the configured alignment
+void ImageFormat::setIOParams(const IOParams &params){
+	ioParams_ = params;
+	serializer_.setIOParams(ioParams_);
+	if (ioParams_.memoryBudgetBytes_ && !memoryBudget_) {
+		memoryBudget_ = new MemoryBudget(ioParams_.memoryBudgetBytes_);
+		serializer_.setMemoryBudget(memoryBudget_);
+	}
+}
+// pixel write statistics, summed over all worker threads
+IOStats ImageFormat::getStats(void) const{
+	IOStats stats;
+	if (workerSerializers_){
+		for (uint32_t i = 0; i < concurrency_; ++i)
+			stats.add(workerSerializers_[i]->getStats());
+	}
+#ifdef IOBENCH_HAVE_URING
+	if (ringAggregator_)
+		stats.add(ringAggregator_->getStats());
+#endif
+
+	return stats;
+}
+// buffer pool statistics, summed over all pools
+PoolStats ImageFormat::getPoolStats(void) const{
+	PoolStats stats = serializer_.getPoolStats();
+	if (workerSerializers_){
+		for (uint32_t i = 0; i < concurrency_; ++i)
+			stats.add(workerSerializers_[i]->getPoolStats());
+	}
+
+	return stats;
+}
+// arena statistics, summed over all arenas
+ArenaStats ImageFormat::getArenaStats(void) const{
+	ArenaStats stats;
+	if (bufferArenas_) {
+		for (uint32_t i = 0; i < numNodes_; ++i){
+			if (bufferArenas_[i])
+				stats.add(bufferArenas_[i]->getStats());
+		}
+	}
+
+	return stats;
+}
+BudgetStats ImageFormat::getBudgetStats(void) const{
+	return memoryBudget_ ? memoryBudget_->getStats() : BudgetStats();
+}
+NumaStats ImageFormat::getNumaStats(void) const{
+	NumaStats stats;
+	if (ioParams_.numa_){
+		stats.nodes_ = numNodes_;
+		stats.buffers_ = numaBuffers_;
+		stats.remote_ = numaRemote_;
+	}
+
+	return stats;
+}
+// submit any writes that thread has queued
+bool ImageFormat::flush(uint32_t threadId){
+	return workerSerializers_[threadId]->flush();
+}
 void ImageFormat::init(uint32_t width, uint32_t height,
 						uint16_t numcomps, uint64_t packedRowBytes,
 						uint32_t nominalStripHeight,
 						bool chunked){
+	chunked_ = chunked;
 	imageStripper_ = new ImageStripper(width, height,numcomps,
 						packedRowBytes,nominalStripHeight,
 						headerLength_,
-						WRTSIZE, chunked ? serializer_.getPool(): nullptr);
+						ioParams_.writeSize_);
 
 	maxPixelWrites_ = chunked ?
 						imageStripper_->numUniqueChunks() :
@@ -70,20 +179,247 @@ bool ImageFormat::encodeInit(std::string filename,
 							bool asynch){
 	filename_ = filename;
 	concurrency_ = concurrency;
+	// mapped writes complete synchronously
+	if (ioParams_.mmap_)
+		asynch = false;
 	auto maxRequests = imageStripper_->numStrips();
 	serializer_.setMaxSimulatedWrites(maxRequests);
-	mode_ = direct ? "wd" : "w";
-	if(!serializer_.open(filename_, mode_,asynch))
+	mode_ = ioParams_.overwrite_ ? "o" : "w";
+	if (direct)
+		mode_ += "d";
+	else if (ioParams_.mmap_)
+		mode_ += "+";
+	// with a ring aggregator, workers have no rings of their own
+	bool aggregate = false;
+#ifdef IOBENCH_HAVE_URING
+	aggregate = asynch && !ioParams_.linuxAio_ && ioParams_.ringAggregator_;
+#endif
+	if(!serializer_.open(filename_, mode_,asynch && !aggregate))
+		return false;
+	if (ioParams_.preallocate_ || ioParams_.overwrite_){
+		uint64_t len = imageStripper_->fileLen();
+		// final O_DIRECT write is padded to a full chunk
+		if (direct)
+			len = ((len + ioParams_.writeSize_ - 1) / ioParams_.writeSize_) * ioParams_.writeSize_;
+		if (!serializer_.allocate(len, ioParams_.preallocate_))
+			return false;
+	}
+	if (ioParams_.mmap_ && !serializer_.map(imageStripper_->fileLen()))
+		return false;
+	if (ioParams_.numa_ && !initNuma())
+		return false;
+	workerNodes_.resize(concurrency_, 0);
+	workerBound_.resize(concurrency_, 0);
+	if (ioParams_.numa_){
+		for (uint32_t i = 0; i < concurrency_; ++i)
+			workerNodes_[i] = numaNodeOfWorker(numaTopology_, i, concurrency_);
+	}
+	bufferDepots_ = new BufferDepot*[numNodes_];
+	for (uint32_t i = 0; i < numNodes_; ++i)
+		bufferDepots_[i] = new BufferDepot();
+	serializer_.setBufferDepot(bufferDepots_[0]);
+	// fixed buffers and completion reapers are io_uring features
+	bool uring = asynch && !ioParams_.linuxAio_ && !aggregate;
+	uint64_t arenaBytes = ioParams_.arenaBytes_;
+	if (uring)
+		arenaBytes = std::max(arenaBytes, ioParams_.fixedBufferBytes_);
+	if (arenaBytes && !ioParams_.mmap_)
+		createBufferArena(arenaBytes);
+	if (uring && ioParams_.completionMode_ != COMPLETION_INLINE)
+		createCompletionReapers();
+	if (!asynch && ioParams_.ioThreads_)
+		writeOffloader_ = new WriteOffloader(ioParams_.ioThreads_, ioParams_.queueDepth_);
+	else if (!asynch && ioParams_.noWaitThreads_)
+		writeOffloader_ = new WriteOffloader(ioParams_.noWaitThreads_, ioParams_.queueDepth_);
+	if (aggregate && !createRingAggregator())
 		return false;
 	// create one serializer per thread and attach to parent serializer
 	workerSerializers_ = new Serializer*[concurrency];
 	for (uint32_t i = 0; i < concurrency_; ++i){
-		workerSerializers_[i] = new Serializer(i,false);
+		uint32_t node = workerNodes_[i];
+		workerSerializers_[i] = new Serializer(i,false,
+									bufferArenas_ ? bufferArenas_[node] : nullptr);
+		workerSerializers_[i]->setBufferDepot(bufferDepots_[node]);
+		workerSerializers_[i]->setMemoryBudget(memoryBudget_);
 		workerSerializers_[i]->attach(&serializer_);
+		if (numCompletionReapers_)
+			workerSerializers_[i]->setCompletionReaper(
+					completionReapers_[workerReapers_[i]]);
+		workerSerializers_[i]->setWriteOffloader(writeOffloader_);
+		if (ringAggregator_)
+			workerSerializers_[i]->attachRingAggregator(ringAggregator_);
+	}
+	if (chunked_) {
+		workerChunkArrays_ = new StripChunkArray[concurrency];
+		uint64_t maxChunks = imageStripper_->maxStripChunks();
+		for (uint32_t i = 0; i < concurrency_; ++i)
+			workerChunkArrays_[i].reserve(maxChunks);
+	}
+	// strips are encoded in place in a mapped file
+	if (ioParams_.prewarm_ && !(ioParams_.mmap_ && !chunked_))
+		prewarmPools(asynch || writeOffloader_);
+
+	return true;
+}
+// stock each worker's pool with the buffers it uses in steady state :
+// the buffers of the strip it encodes, and those of writes in flight,
+// within the image's unique chunks, or strips, and the memory budget.
+// Each worker's buffers are touched on a thread bound to its NUMA node.
+void ImageFormat::prewarmPools(bool inFlight){
+	uint32_t strip = imageStripper_->numStrips() > 1 ? 1 : 0;
+	auto chunkInfo = imageStripper_->getChunkInfo(strip);
+	uint64_t len = chunked_ ? ioParams_.writeSize_ : chunkInfo.len();
+	uint64_t perStrip = chunked_ ? chunkInfo.numChunks() : 1;
+	// a request holds at most the buffers of a strip
+	uint32_t perRequest = chunked_ ? (uint32_t)imageStripper_->maxStripChunks() : 1;
+	uint64_t count = perStrip;
+	if (inFlight)
+		count += std::min<uint64_t>(ioParams_.queueDepth_, perStrip);
+	uint64_t total = chunked_ ? imageStripper_->numUniqueChunks() : imageStripper_->numStrips();
+	count = std::min(count, (total + concurrency_ - 1) / concurrency_);
+	if (ioParams_.memoryBudgetBytes_)
+		count = std::min(count, ioParams_.memoryBudgetBytes_ / concurrency_ / len);
+	if (!count)
+		return;
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < concurrency_; ++i){
+		threads.emplace_back([this, i, count, len, perRequest] {
+			if (ioParams_.numa_){
+				bindThreadToNumaNode(numaTopology_, workerNodes_[i], pthread_self());
+				preferNumaNode(numaTopology_, workerNodes_[i]);
+			}
+			workerSerializers_[i]->prewarmPool((uint32_t)count, len, perRequest);
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+}
+// one reaper thread for each group of reaperGroupSize_ worker rings.
+// With NUMA placement, rings are grouped within each node
+void ImageFormat::createCompletionReapers(void){
+#ifdef IOBENCH_HAVE_URING
+	uint32_t groupSize = std::max<uint32_t>(ioParams_.reaperGroupSize_, 1);
+	std::vector<uint32_t> nodeWorkers(numNodes_, 0);
+	for (uint32_t i = 0; i < concurrency_; ++i)
+		nodeWorkers[workerNodes_[i]]++;
+	std::vector<uint32_t> firstReaper(numNodes_, 0);
+	std::vector<uint32_t> nodeReapers(numNodes_, 0);
+	for (uint32_t node = 0; node < numNodes_; ++node){
+		firstReaper[node] = numCompletionReapers_;
+		nodeReapers[node] = (nodeWorkers[node] + groupSize - 1) / groupSize;
+		numCompletionReapers_ += nodeReapers[node];
+	}
+	completionReapers_ = new CompletionReaper*[numCompletionReapers_];
+	for (uint32_t node = 0; node < numNodes_; ++node){
+		for (uint32_t i = 0; i < nodeReapers[node]; ++i){
+			auto reaper = new CompletionReaper(ioParams_);
+			if (ioParams_.numa_)
+				reaper->bindToNumaNode(numaTopology_, node);
+			completionReapers_[firstReaper[node] + i] = reaper;
+		}
+	}
+	// workers of a node are spread over the node's reapers
+	std::vector<uint32_t> rank(numNodes_, 0);
+	workerReapers_.resize(concurrency_);
+	for (uint32_t i = 0; i < concurrency_; ++i){
+		uint32_t node = workerNodes_[i];
+		workerReapers_[i] = firstReaper[node] + rank[node]++ % nodeReapers[node];
+	}
+#endif
+}
+// single submission thread and ring, fed by all workers
+bool ImageFormat::createRingAggregator(void){
+#ifdef IOBENCH_HAVE_URING
+	ringAggregator_ = new RingAggregator(ioParams_, concurrency_);
+	return serializer_.attachRingAggregator(ringAggregator_);
+#else
+	return false;
+#endif
+}
+// discover NUMA nodes that workers are spread over
+bool ImageFormat::initNuma(void){
+	if (!discoverNumaTopology(numaTopology_) || !numaTopology_.numNodes()){
+		printf("Unable to discover NUMA topology\n");
+		return false;
 	}
+	numNodes_ = numaTopology_.numNodes();
 
 	return true;
 }
+// run calling worker thread on its node, and prefer its node for
+// memory it touches first
+void ImageFormat::bindWorker(uint32_t threadId){
+	if (!ioParams_.numa_ || workerBound_[threadId])
+		return;
+	workerBound_[threadId] = 1;
+	bindThreadToNumaNode(numaTopology_, workerNodes_[threadId], pthread_self());
+	preferNumaNode(numaTopology_, workerNodes_[threadId]);
+}
+// block until len bytes of buffers fit in the memory budget, and reserve
+// them for the worker's pool, which draws on the reservation as it hands out
+// buffers. The worker reclaims its own completed writes while it waits,
+// and gives up once no buffer has been reclaimed for a while : the buffers
+// holding the budget may belong to chunks that only this worker can complete.
+// Callers release whatever is left of the reservation once they hold
+// their buffers
+void ImageFormat::waitForBudget(uint32_t threadId, uint64_t len){
+	if (!memoryBudget_)
+		return;
+	auto ser = workerSerializers_[threadId];
+	if (!memoryBudget_->tryReserve(len)) {
+		uint64_t start = nowNs();
+		uint64_t lastCredit = start;
+		bool overrun = false;
+		while (!memoryBudget_->tryReserve(len)){
+			ser->poll();
+			uint64_t now = nowNs();
+			if (memoryBudget_->waitForCredit(budgetPollUs)) {
+				lastCredit = now;
+			} else if (now - lastCredit > budgetStallUs * 1000) {
+				overrun = true;
+				memoryBudget_->charge(len);
+				break;
+			}
+		}
+		memoryBudget_->addWait(nowNs() - start, overrun);
+	}
+	ser->reserveBudget(len);
+}
+// with NUMA placement, each node has its own arena, sized in proportion
+// to the node's workers
+bool ImageFormat::createBufferArena(uint64_t arenaBytes){
+	// chunks are all one write size long, while strips are at most
+	// as long as the first strip, which includes the header
+	uint64_t slotLen = chunked_ ? ioParams_.writeSize_ : imageStripper_->getChunkInfo(0).len();
+	std::vector<uint32_t> nodeWorkers(numNodes_, 0);
+	for (uint32_t i = 0; i < concurrency_; ++i)
+		nodeWorkers[workerNodes_[i]]++;
+	bufferArenas_ = new BufferArena*[numNodes_];
+	bool rc = true;
+	for (uint32_t node = 0; node < numNodes_; ++node){
+		bufferArenas_[node] = nullptr;
+		if (!nodeWorkers[node])
+			continue;
+		uint64_t numSlots = (arenaBytes * nodeWorkers[node] / concurrency_) / slotLen;
+		if (!numSlots) {
+			printf("Arena memory is smaller than a single buffer - arena disabled\n");
+			rc = false;
+			continue;
+		}
+		auto arena = new BufferArena(slotLen, numSlots, ioParams_.alignment_,
+										ioParams_.hugePageBytes_, ioParams_.lockArena_,
+										ioParams_.numa_ ? &numaTopology_ : nullptr, node);
+		if (!arena->valid()){
+			printf("Unable to allocate buffer arena - arena disabled\n");
+			delete arena;
+			rc = false;
+			continue;
+		}
+		bufferArenas_[node] = arena;
+	}
+
+	return rc;
+}
 bool ImageFormat::reopenAsBuffered(void){
 	return serializer_.reopenAsBuffered();
 }
@@ -92,10 +428,19 @@ ImageStripper* ImageFormat::getImageStripper(void){
 }
 // corrected for header
 IOBuf* ImageFormat::getPoolBuffer(uint32_t threadId,uint32_t strip){
+	bindWorker(threadId);
 	auto chunkInfo = imageStripper_->getChunkInfo(strip);
 	uint64_t len = chunkInfo.len();
-	auto ioBuf = workerSerializers_[threadId]->getPoolBuffer(len);
-	ioBuf->index_ = strip;
+	auto ser = workerSerializers_[threadId];
+	// strip is encoded in place, if file is mapped
+	auto ioBuf = ser->getMappedBuffer(chunkInfo.first_.x0_, len);
+	if (!ioBuf) {
+		waitForBudget(threadId, len);
+		ioBuf = ser->getPoolBuffer(len);
+		ser->releaseBudgetReservation();
+	}
+	// a recycled buffer may be longer than this strip
+	ioBuf->updateLen(len);
 	ioBuf->offset_ = chunkInfo.first_.x0_;
 	uint64_t headerSize = ((strip == 0) ? headerLength_ : 0);
 	ioBuf->skip_ = 0;
@@ -107,30 +452,34 @@ IOBuf* ImageFormat::getPoolBuffer(uint32_t threadId,uint32_t strip){
 
 	return ioBuf;
 }
+// the returned array belongs to the worker, and is reused for its next strip
 StripChunkArray* ImageFormat::getStripChunkArray(uint32_t threadId,uint32_t strip){
+	bindWorker(threadId);
+	// every chunk of strip may need a buffer of a full write size
+	waitForBudget(threadId, imageStripper_->getChunkInfo(strip).numChunks() * ioParams_.writeSize_);
 	auto pool = workerSerializers_[threadId]->getPool();
-	return
-		imageStripper_->getStrip(strip)->getStripChunkArray(pool,
+	auto chunkArray = workerChunkArrays_ + threadId;
+	imageStripper_->fillStripChunkArray(strip, pool,
 								strip == 0 ? header_ : nullptr,
-								strip == 0 ? headerLength_ : 0);
+								strip == 0 ? headerLength_ : 0,
+								chunkArray);
+	// seams created by neighbouring strips were already charged
+	workerSerializers_[threadId]->releaseBudgetReservation();
+
+	return chunkArray;
 }
 bool ImageFormat::encodePixels(uint32_t threadId,StripChunkArray * chunkArray){
-	auto buffers = new IOBuf*[chunkArray->numBuffers_];
+	auto buffers = chunkArray->readyBufs_;
 	uint32_t count = 0;
 	for (uint32_t i = 0; i < chunkArray->numBuffers_; ++i){
-		auto ch = chunkArray->stripChunks_[i];
-		if (ch->acquire()) {
-			auto b = chunkArray->ioBufs_[i];
-			b->ref();
-			buffers[count++] = b;
-		}
+		if (imageStripper_->acquire(chunkArray->stripChunks_[i]))
+			buffers[count++] = chunkArray->ioBufs_[i];
 	}
 	bool ret = true;
 	if (count) {
 		ret =	encodePixels(threadId, buffers,count);
 		assert(ret);
 	}
-	delete[] buffers;
 
 	return ret;
 }
@@ -139,6 +488,19 @@ bool ImageFormat::encodePixels(uint32_t threadId,
 								uint32_t numBuffers){
 	assert(numBuffers);
 	auto ser = workerSerializers_[threadId];
+	// node of a pool buffer is sampled from its first page when the buffer
+	// is allocated. Mapped buffers are not sampled
+	if (ioParams_.numa_){
+		int32_t nodeId = numaTopology_.nodeIds_[workerNodes_[threadId]];
+		for (uint32_t i = 0; i < numBuffers; ++i){
+			int32_t bufferNodeId = buffers[i]->numaNode_;
+			if (bufferNodeId < 0)
+				continue;
+			numaBuffers_++;
+			if (bufferNodeId != nodeId)
+				numaRemote_++;
+		}
+	}
 	uint64_t toWrite = FileIO::bytesToWrite(buffers, numBuffers, mode_);
 	uint64_t written = ser->write(buffers[0]->offset_, buffers,numBuffers);
 	if (written != toWrite){
@@ -149,11 +511,17 @@ bool ImageFormat::encodePixels(uint32_t threadId,
 				toWrite - written);
 		return false;
 	}
+	// flushed before the write is counted : the worker that counts the
+	// last write closes every worker's serializer
+	if (ioParams_.taskFlush_ && !ser->flush())
+		return false;
 	uint64_t writes = 0;
 	for (uint32_t i = 0; i < numBuffers; ++i)
 	   writes = ++numPixelWrites_;
+	// asynchronous write failures are only detected
+	// when thread serializers are closed
 	if (writes == maxPixelWrites_)
-		encodeFinish();
+		return encodeFinish();
 
 	return true;
 }
@@ -163,10 +531,16 @@ bool ImageFormat::isHeaderEncoded(void)
 }
 bool ImageFormat::closeThreadSerializers(void){
 	// close all thread serializers
+	bool rc = true;
 	for (uint32_t i = 0; i < concurrency_; ++i)
-		workerSerializers_[i]->close();
+		rc &= workerSerializers_[i]->close();
+#ifdef IOBENCH_HAVE_URING
+	// workers have waited for their aggregated writes
+	if (ringAggregator_)
+		rc &= ringAggregator_->close();
+#endif
 
-	return true;
+	return rc;
 }
 bool ImageFormat::close(void){
 	bool rc = closeThreadSerializers();
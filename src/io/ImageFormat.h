@@ -19,10 +19,16 @@
 
 #include <string>
 #include <functional>
+#include <vector>
 
 #include "ImageStripper.h"
 #include "Serializer.h"
 #include "BufferPool.h"
+#include "BufferArena.h"
+#include "IOParams.h"
+#include "WriteOffloader.h"
+#include "NumaTopology.h"
+#include "MemoryBudget.h"
 
 namespace io {
 
@@ -40,6 +46,13 @@ public:
 	void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
 	virtual bool close(void);
 	void setEncodeFinisher(std::function<bool(void)> finisher);
+	void setIOParams(const IOParams &params);
+	IOStats getStats(void) const;
+	PoolStats getPoolStats(void) const;
+	ArenaStats getArenaStats(void) const;
+	NumaStats getNumaStats(void) const;
+	BudgetStats getBudgetStats(void) const;
+	bool flush(uint32_t threadId);
 	virtual void init(uint32_t width,
 						uint32_t height,
 						uint16_t numcomps,
@@ -62,6 +75,13 @@ public:
 protected:
 	bool closeThreadSerializers(void);
 	bool isHeaderEncoded(void);
+	bool initNuma(void);
+	void bindWorker(uint32_t threadId);
+	void waitForBudget(uint32_t threadId, uint64_t len);
+	bool createBufferArena(uint64_t arenaBytes);
+	void prewarmPools(bool inFlight);
+	void createCompletionReapers(void);
+	bool createRingAggregator(void);
 	uint8_t *header_;
 	size_t headerLength_;
 	uint32_t encodeState_;
@@ -71,9 +91,30 @@ protected:
 	std::string mode_;
 	uint32_t concurrency_;
 	Serializer **workerSerializers_;
+	// chunk array of each worker, reused from strip to strip
+	StripChunkArray *workerChunkArrays_;
 	std::atomic<uint64_t> numPixelWrites_;
 	uint64_t maxPixelWrites_;
 	std::function<bool(void)> encodeFinisher_;
+	IOParams ioParams_;
+	bool chunked_;
+	// one arena and one depot per NUMA node, or a single one
+	uint32_t numNodes_;
+	BufferArena **bufferArenas_;
+	BufferDepot **bufferDepots_;
+	NumaTopology numaTopology_;
+	// NUMA node of each worker, and whether worker thread is bound to it
+	std::vector<uint32_t> workerNodes_;
+	std::vector<uint8_t> workerBound_;
+	std::atomic<uint64_t> numaBuffers_;
+	std::atomic<uint64_t> numaRemote_;
+	MemoryBudget *memoryBudget_;
+	uint32_t numCompletionReapers_;
+	CompletionReaper **completionReapers_;
+	// completion reaper of each worker
+	std::vector<uint32_t> workerReapers_;
+	WriteOffloader *writeOffloader_;
+	RingAggregator *ringAggregator_;
 };
 
 }
@@ -24,20 +24,21 @@
 
 #include "IBufferPool.h"
 #include "RefCounted.h"
+#include "SeamWindow.h"
 #include "util.h"
 
 namespace io {
 
 /*
- * Each strip is divided into a collection of IOChunks, and
- * each IOChunk contains an IOBuf, which is used for disk IO.
- * An IOBuf's offset is always aligned, and its length is always equal to WRTSIZE,
+ * Each strip is divided into a collection of chunks, and
+ * each chunk is written from an IOBuf.
+ * An IOBuf's offset is always aligned, and its length is always equal to the write size,
  * except possibly the final IOBuf of the final strip. Also, they are corrected
  * for the header bytes which are located right before the beginning of the
  * first strip - the header bytes are included in the first IOBuf of the first
  * strip.
  *
- * IOChunks can be shared between neighbouring strips if they
+ * Chunks can be shared between neighbouring strips if they
  * share a common seam, which happens when the boundary between two strips
  * is not aligned.
  */
@@ -62,7 +63,7 @@ struct ChunkInfo{
 		if (!writeSize_)
 			return;
 		last_.x0_      = lastBegin(logicalOffset,logicalLen);
-		assert(IOBuf::isAlignedToWriteSize(last_.x0_));
+		assert(aligned(last_.x0_));
 		last_.x1_      = stripEnd(logicalOffset,logicalLen);
 		first_.x0_     = stripOffset(logicalOffset);
 		first_.x1_     =
@@ -95,8 +96,8 @@ struct ChunkInfo{
 		uint64_t nonSeamBegin = hasFirstSeam() ? first_.x1_ : first_.x0_;
 		uint64_t nonSeamEnd   = hasLastSeam()  ? last_.x0_  : last_.x1_;
 		assert(nonSeamEnd >= nonSeamBegin );
-		assert(IOBuf::isAlignedToWriteSize(nonSeamBegin));
-		assert(isFinalStrip_ || IOBuf::isAlignedToWriteSize(nonSeamEnd));
+		assert(aligned(nonSeamBegin));
+		assert(isFinalStrip_ || aligned(nonSeamEnd));
 		uint64_t rc = (nonSeamEnd - nonSeamBegin + writeSize_ - 1) / writeSize_;
 		if (hasFirstSeam())
 			rc++;
@@ -106,11 +107,15 @@ struct ChunkInfo{
 
 		return rc;
 	}
+	// true if off lies on a write size boundary
+	bool aligned(uint64_t off) const{
+		return off % writeSize_ == 0;
+	}
 	bool hasFirstSeam(void){
-		return !isFirstStrip_ && !IOBuf::isAlignedToWriteSize(first_.x0_);
+		return !isFirstStrip_ && !aligned(first_.x0_);
 	}
 	bool hasLastSeam(void){
-		return !isFinalStrip_ && !IOBuf::isAlignedToWriteSize(last_.x1_);
+		return !isFinalStrip_ && !aligned(last_.x1_);
 	}
 	// not usually aligned
 	uint64_t stripOffset(uint64_t logicalOffset){
@@ -154,319 +159,80 @@ struct ChunkInfo{
 	uint64_t headerSize_;
 	IBufferPool *pool_;
 };
-struct IOChunk : public RefCounted {
-	IOChunk(uint64_t offset,uint64_t len, uint64_t allocLen, IBufferPool *pool) :
-		offset_(offset),
-		len_(len),
-		allocLen_(allocLen),
-		buf_(nullptr),
-		acquireCount_(0),
-		shareCount_(1)
-	{
-		if (pool){
-			alloc(pool);
-			share();
-		}
-	}
-private:
-	~IOChunk() {
-		RefReaper::unref(buf_);
-	}
-public:
-	IOChunk* share(void){
-		shareCount_++;
-		assert(buf_->data_);
-		ref();
-
-		return this;
-	}
-	bool isShared(void){
-		return shareCount_ > 1;
-	}
-	void setHeader(uint8_t *headerData, uint64_t headerSize){
-		memcpy(buf_->data_ , headerData, headerSize);
-		buf_->skip_ = headerSize;
-	}
-	bool acquire(void){
-		 return (++acquireCount_ == shareCount_);
-	}
-	IOBuf* buf(void) const{
-		return buf_;
-	}
-	void updateLen(uint64_t len){
-		assert(len <= allocLen_);
-		len_ = len;
-		if (buf_)
-			buf_->updateLen(len);
-	}
-	void alloc(IBufferPool* pool){
-		assert(!buf_ || buf_->data_);
-		assert(pool);
-		if (buf_ && buf_->data_)
-			return;
-		buf_ = pool->get(allocLen_);
-		buf_->len_ = len_;
-		buf_->offset_ = offset_;
-	}
-	uint64_t offset_;
-	uint64_t len_;
-private:
-	uint64_t allocLen_;
-	IOBuf *buf_;
-	std::atomic<uint32_t> acquireCount_;
-	uint32_t shareCount_;
-};
-
-
 /**
- * A strip chunk wraps an IOChunk (which may be shared with the
- * strip's neighbour), and it also stores a write offset and write length
- * for its assigned portion of a shared IOChunk.
- * If there is no sharing, then  write offset is zero,
- * and write length equals WRTSIZE.
+ * A strip chunk is a strip's view of one of its chunks : the chunk's offset
+ * and length, and the offset and length of the strip's portion of the chunk's IOBuf.
+ * If there is no sharing, then write offset is zero,
+ * and write length equals the write size.
  */
-struct StripChunk : public RefCounted {
-	StripChunk(IOChunk *ioChunk,
-				uint64_t writeableOffset,
-				uint64_t writeableLen) :
-		writeableOffset_(writeableOffset),
-		writeableLen_(writeableLen),
-		ioChunk_(ioChunk)
-	{
-		// we may need to extend a shared ioChunk_'s length
-		if (ioChunk_->isShared() &&
-				ioChunk_->offset_ + ioChunk_->len_ == writeableOffset)
-			ioChunk_->updateLen(ioChunk_->len_ + writeableLen);
-
-		assert(writeableOffset < len());
-		assert(writeableLen <= len());
-
-	}
-private:
-	~StripChunk(){
-		RefReaper::unref(ioChunk_);
-	}
-public:
-	void alloc(IBufferPool* pool){
-		ioChunk_->alloc(pool);
-	}
-	uint64_t offset(void){
-		return ioChunk_->offset_;
-	}
-	uint64_t len(void){
-		return ioChunk_->len_;
-	}
-	bool acquire(void){
-		return ioChunk_->acquire();
-	}
-	bool isShared(void){
-		return ioChunk_->isShared();
-	}
-	void setHeader(uint8_t *headerData, uint64_t headerSize){
-		ioChunk_->setHeader(headerData, headerSize);
-		writeableOffset_ = headerSize;
-	}
+struct StripChunk {
+	StripChunk() : offset_(0),
+					len_(0),
+					writeableOffset_(0),
+					writeableLen_(0),
+					seam_(nullptr)
+	{}
+	uint64_t offset_;
+	uint64_t len_;
 	// relative to beginning of IOBuf data buffer
 	uint64_t writeableOffset_;
 	uint64_t writeableLen_;
-	IOChunk *ioChunk_;
+	// seam shared with a neighbour, if any
+	ChunkSeam *seam_;
 };
 
 
 /**
- * Container for an array of buffers and an array of chunks
- *
+ * Container for an array of buffers and an array of chunks.
+ * Each worker reuses a single container from strip to strip,
+ * and its arrays only grow, at least doubling each time.
  */
 struct StripChunkArray{
-	StripChunkArray(StripChunk** chunks, IOBuf **buffers,uint64_t numBuffers, IBufferPool *pool)
-		: ioBufs_(buffers),
-		  stripChunks_(chunks),
-		  numBuffers_(numBuffers),
-		  pool_(pool)
-	{
-		for (uint64_t i = 0; i < numBuffers_; ++i)
-			assert(ioBufs_[i]->data_);
-	}
+	StripChunkArray()
+		: ioBufs_(nullptr),
+		  stripChunks_(nullptr),
+		  readyBufs_(nullptr),
+		  numBuffers_(0),
+		  capacity_(0),
+		  pool_(nullptr)
+	{}
 	~StripChunkArray(void){
 		delete[] ioBufs_;
 		delete[] stripChunks_;
+		delete[] readyBufs_;
 	}
-	IOBuf ** ioBufs_;
-	StripChunk ** stripChunks_;
-	uint64_t numBuffers_;
-	IBufferPool *pool_;
-};
-
-/**
- * A strip contains an array of StripChunks
- *
- */
-struct Strip  {
-	Strip(uint64_t offset,uint64_t len,Strip* neighbour) :
-		logicalOffset_(offset),
-		logicalLen_(len),
-		stripChunks_(nullptr),
-		numChunks_(0),
-		leftNeighbour_(neighbour)
-	{}
-	~Strip(void){
-		if (stripChunks_){
-			for (uint32_t i = 0; i < numChunks_; ++i)
-				RefReaper::unref(stripChunks_[i]);
+	// grow arrays to hold numBuffers buffers
+	void reserve(uint64_t numBuffers){
+		if (numBuffers > capacity_){
+			delete[] ioBufs_;
 			delete[] stripChunks_;
+			delete[] readyBufs_;
+			capacity_ 	 = std::max(numBuffers, 2 * capacity_);
+			ioBufs_ 	 = new IOBuf*[capacity_];
+			stripChunks_ = new StripChunk[capacity_];
+			readyBufs_ 	 = new IOBuf*[capacity_];
 		}
 	}
-	void generateChunks(ChunkInfo chunkInfo, IBufferPool *pool){
-		chunkInfo_ = chunkInfo;
-		numChunks_ = chunkInfo_.numChunks();
-		assert(numChunks_);
-		stripChunks_ = new StripChunk*[numChunks_];
-		uint64_t writeableTotal = 0;
-		if (numChunks_ == 1){
-			bool lastChunkOfAll  = chunkInfo.isFinalStrip_;
-			bool firstSeam       = chunkInfo.hasFirstSeam();
-			bool lastSeam        = !lastChunkOfAll && chunkInfo.hasLastSeam();
-			IOChunk* ioChunk;
-			if (firstSeam){
-				ioChunk = leftNeighbour_->finalChunk()->ioChunk_;
-				if (lastSeam)
-					ioChunk->share();
-			}
-			else {
-				ioChunk = 	new IOChunk(0,chunkInfo.first_.x1_,
-											chunkInfo.writeSize_,
-											(lastSeam ? pool : nullptr));
-			}
-			uint64_t writeOffset,writeLen;
-			if (chunkInfo.isFirstStrip_){
-				writeOffset = chunkInfo_.headerSize_;
-				writeLen    = chunkInfo.first_.x1_ - chunkInfo_.headerSize_ ;
-			} else {
-				assert(chunkInfo.last_.x0_ <= chunkInfo.first_.x0_);
-				writeOffset = 	chunkInfo.first_.x0_ - chunkInfo.last_.x0_;
-				writeLen    =	chunkInfo.first_.len();
-			}
-			stripChunks_[0] = new StripChunk(ioChunk,writeOffset,writeLen);
-			if (chunkInfo.isFinalStrip_)
-				ioChunk->updateLen(chunkInfo.last_.len());
-			writeableTotal = stripChunks_[0]->writeableLen_;
-		}
-		for (uint32_t i = 0; i < numChunks_ && numChunks_>1; ++i ){
-			uint64_t off = (chunkInfo.first_.x1_ - chunkInfo_.writeSize_) +
-								i * chunkInfo_.writeSize_;
-			bool lastChunkOfAll  = chunkInfo.isFinalStrip_ && (i == numChunks_-1);
-			uint64_t len =
-					lastChunkOfAll ? (chunkInfo_.last_.len()) : chunkInfo_.writeSize_;
-			uint64_t writeableOffset = 0;
-			uint64_t writeableLen = len;
-			bool sharedLastChunk = false;
-			bool firstSeam       = (i == 0) && chunkInfo.hasFirstSeam();
-			bool lastSeam        =
-					(i == numChunks_-1) && !lastChunkOfAll && chunkInfo.hasLastSeam();
-			if (firstSeam){
-				assert(leftNeighbour_);
-				off = leftNeighbour_->finalChunk()->offset();
-				assert(chunkInfo_.first_.x0_  > off);
-
-				writeableOffset = chunkInfo_.first_.x0_ - off;
-				writeableLen    = chunkInfo_.first_.len();
-
-				assert(writeableLen && writeableLen < chunkInfo_.writeSize_);
-				assert(writeableOffset && writeableOffset < chunkInfo_.writeSize_);
-			} else if (lastSeam){
-				off   = chunkInfo_.last_.x0_;
-				writeableLen = chunkInfo_.last_.len();
-				assert(writeableLen && writeableLen < chunkInfo_.writeSize_);
-				if (lastChunkOfAll)
-					len = writeableLen;
-				else
-					sharedLastChunk = true;
-			} else if (chunkInfo_.isFirstStrip_ && i == 0){
-				writeableOffset += chunkInfo_.headerSize_;
-				writeableLen -= chunkInfo_.headerSize_;
-			}
-			writeableTotal += writeableLen;
-
-			// first seam can never be last seam
-			assert(!lastSeam || !firstSeam);
-			assert(IOBuf::isAlignedToWriteSize(off));
-			assert(lastChunkOfAll || IOBuf::isAlignedToWriteSize(len));
-
-			IOChunk* ioChunk = nullptr;
-			if (firstSeam)
-				ioChunk = leftNeighbour_->finalChunk()->ioChunk_;
-			else
-				ioChunk = new IOChunk(off,len,chunkInfo_.writeSize_,
-										(sharedLastChunk ? pool : nullptr));
-			assert(!firstSeam || ioChunk->isShared());
-
-			stripChunks_[i] = new StripChunk(ioChunk,
-												writeableOffset,
-												writeableLen);
-		}
-
-		// validation
-		assert(!chunkInfo.isFirstStrip_ || stripChunks_[0]->offset() == 0);
-		assert(logicalLen_ == writeableTotal);
-
-		uint64_t writeableEnd = 0;
-		(void)writeableEnd;
-		if (numChunks_ > 1) {
-			writeableEnd =	stripChunks_[numChunks_-1]->offset() +
-									stripChunks_[numChunks_-1]->writeableLen_;
-		}
-		else {
-			writeableEnd = stripChunks_[0]->offset() +
-							stripChunks_[0]->writeableOffset_ +
-								stripChunks_[0]->writeableLen_;
-		}
-		assert(writeableEnd == chunkInfo_.last_.x1_);
-
-		uint64_t writeableBegin =
-				stripChunks_[0]->offset() + stripChunks_[0]->writeableOffset_;
-		(void)writeableBegin;
-		assert(writeableBegin ==
-				chunkInfo_.first_.x0_ +
-					(chunkInfo_.isFirstStrip_ ? chunkInfo_.headerSize_ : 0));
-		assert(writeableEnd - writeableBegin == logicalLen_);
-	}
-	StripChunkArray* getStripChunkArray(IBufferPool *pool, uint8_t *header, uint64_t headerLen){
-		auto buffers = new IOBuf*[numChunks_];
-		auto chunks  = new StripChunk*[numChunks_];
-		for (uint32_t i = 0; i < numChunks_; ++i){
-			auto stripChunk = stripChunks_[i];
-			auto ioChunk 	= stripChunk->ioChunk_;
-			stripChunk->alloc(pool);
-			// set header on first chunk of first strip
-			if (header && i == 0)
-				stripChunk->setHeader(header, headerLen);
-			chunks[i] 	= stripChunk;
-			buffers[i] 	= ioChunk->buf();
-		}
-		for (uint32_t i = 0; i < numChunks_; ++i){
-			assert(buffers[i]->data_);
-			assert(buffers[i]->len_);
-		}
-
-		return new StripChunkArray(chunks,buffers,numChunks_,pool);
-	}
-	StripChunk* finalChunk(void){
-		return stripChunks_[numChunks_-1];
-	}
-	StripChunk* firstChunk(void){
-		return stripChunks_[0];
+	void resize(uint64_t numBuffers){
+		reserve(numBuffers);
+		numBuffers_ = numBuffers;
 	}
-	uint64_t logicalOffset_;
-	uint64_t logicalLen_;
-	StripChunk** stripChunks_;
-	uint64_t numChunks_;
-	Strip *leftNeighbour_;
-	ChunkInfo chunkInfo_;
+	IOBuf ** ioBufs_;
+	StripChunk * stripChunks_;
+	// buffers of chunks that are ready to be written
+	IOBuf ** readyBufs_;
+	uint64_t numBuffers_;
+	uint64_t capacity_;
+	IBufferPool *pool_;
 };
 
 /*
  * Divide an image into strips
  *
+ * In chunked mode, a strip's chunks are laid out when the strip is requested,
+ * straight into its StripChunkArray, and released with it. Chunk i of a strip
+ * begins at the strip's first aligned offset plus i times the write size.
+ * The only state shared between strips is the window of live seams.
  */
 struct ImageStripper{
 	ImageStripper(uint32_t width,
@@ -475,8 +241,7 @@ struct ImageStripper{
 				uint64_t packedRowBytes,
 				uint32_t nominalStripHeight,
 				uint64_t headerSize,
-				uint64_t writeSize,
-				IBufferPool *pool) :
+				uint64_t writeSize) :
 		width_(width),
 		height_(height),
 		numcomps_(numcomps),
@@ -489,45 +254,93 @@ struct ImageStripper{
 								nominalStripHeight),
 		headerSize_(headerSize),
 		writeSize_(writeSize),
-		finalStrip_(numStrips_-1),
-		strips_(new Strip*[numStrips_])
-	{
-		for (uint32_t i = 0; i < numStrips_; ++i){
-			auto neighbour = (i > 0) ? strips_[i-1] : nullptr;
-			strips_[i] =
-					new Strip(i * nominalStripHeight_ * packedRowBytes_,
-								stripHeight(i) * packedRowBytes_,
-								neighbour);
-			if (pool)
-				strips_[i]->generateChunks(getChunkInfo(i), pool);
-		}
-	}
-	~ImageStripper(void){
-		if (strips_){
-			for (uint32_t i = 0; i < numStrips_; ++i)
-				delete strips_[i];
-			delete[] strips_;
+		finalStrip_(numStrips_-1)
+	{}
+	// lay out chunks of strip, with their buffers, in chunkArray
+	void fillStripChunkArray(uint32_t strip,
+								IBufferPool *pool,
+								uint8_t *header,
+								uint64_t headerLen,
+								StripChunkArray *chunkArray){
+		auto chunkInfo = getChunkInfo(strip);
+		uint32_t numChunks = (uint32_t)chunkInfo.numChunks();
+		chunkArray->resize(numChunks);
+		chunkArray->pool_ = pool;
+		auto buffers = chunkArray->ioBufs_;
+		auto chunks  = chunkArray->stripChunks_;
+		generateChunks(strip, chunkInfo, pool, chunks, numChunks);
+		for (uint32_t i = 0; i < numChunks; ++i){
+			auto &chunk = chunks[i];
+			IOBuf *b = nullptr;
+			if (chunk.seam_) {
+				b = chunk.seam_->buf_;
+			} else {
+				b = pool->get(writeSize_);
+				b->updateLen(chunk.len_);
+				b->offset_ = chunk.offset_;
+				b->skip_ = 0;
+			}
+			// set header on first chunk of first strip
+			if (header && i == 0){
+				memcpy(b->data_ , header, headerLen);
+				b->skip_ = headerLen;
+				chunk.writeableOffset_ = headerLen;
+			}
+			assert(b->data_);
+			assert(b->len_);
+			buffers[i] = b;
 		}
 	}
-	Strip* getStrip(uint32_t strip) const{
-		return strips_[strip];
+	// true if chunk is ready to be written. A seam is released
+	// once the last strip sharing it has acquired it.
+	bool acquire(StripChunk &chunk){
+		if (!chunk.seam_)
+			return true;
+		if (!chunk.seam_->acquire())
+			return false;
+		seams_.release(chunk.seam_);
+
+		return true;
 	}
 	uint32_t numStrips(void) const{
 		return numStrips_;
 	}
+	// logical offset and length of strip's pixel data
+	uint64_t stripOffset(uint32_t strip) const{
+		return (uint64_t)strip * nominalStripHeight_ * packedRowBytes_;
+	}
+	uint64_t stripLen(uint32_t strip) const{
+		return stripHeight(strip) * packedRowBytes_;
+	}
+	// length of header plus pixel data
+	uint64_t fileLen(void) const{
+		return headerSize_ + packedRowBytes_ * height_;
+	}
 	uint64_t numUniqueChunks(void) const{
 		return (packedRowBytes_ * height_ + writeSize_ - 1)/writeSize_;
 	}
-	ChunkInfo getChunkInfo(uint32_t strip){
+	// largest number of chunks in a strip
+	uint64_t maxStripChunks(void) const{
+		uint64_t rc = 0;
+		for (uint32_t strip = 0; strip < numStrips_; ++strip)
+			rc = std::max(rc, getChunkInfo(strip).numChunks());
+
+		return rc;
+	}
+	ChunkInfo getChunkInfo(uint32_t strip) const{
 		return ChunkInfo(strip == 0,
 						strip == finalStrip_,
-						strips_[strip]->logicalOffset_,
-						strips_[strip]->logicalLen_,
-						strip == 0 ? 0 : strips_[strip-1]->logicalOffset_,
-						strip == 0 ? 0 : strips_[strip-1]->logicalLen_,
+						stripOffset(strip),
+						stripLen(strip),
+						strip == 0 ? 0 : stripOffset(strip-1),
+						strip == 0 ? 0 : stripLen(strip-1),
 						headerSize_,
 						writeSize_);
 	}
+	// largest number of seams live at once
+	uint64_t peakSeams(void){
+		return seams_.peak();
+	}
 	uint32_t width_;
 	uint32_t height_;
 	uint16_t numcomps_;
@@ -536,13 +349,67 @@ private:
 	uint32_t stripHeight(uint32_t strip) const{
 		return (strip < numStrips_-1) ? nominalStripHeight_ : finalStripHeight_;
 	}
+	// strip holding file offset off
+	uint32_t stripAt(uint64_t off) const{
+		uint64_t stripBytes = (uint64_t)nominalStripHeight_ * packedRowBytes_;
+		if (off < headerSize_ + stripBytes)
+			return 0;
+		return (uint32_t)std::min<uint64_t>((off - headerSize_) / stripBytes, finalStrip_);
+	}
+	// lay out chunks of strip, and look up its seams : a seam's buffer is
+	// taken from pool if strip is the first to request it. A chunk's length
+	// is the write size, except for the final chunk of the image.
+	void generateChunks(uint32_t strip,
+						ChunkInfo &chunkInfo,
+						IBufferPool *pool,
+						StripChunk *chunks,
+						uint32_t numChunks){
+		assert(numChunks);
+		uint64_t headerSize = chunkInfo.isFirstStrip_ ? headerSize_ : 0;
+		uint64_t stripBegin = chunkInfo.first_.x0_ + headerSize;
+		uint64_t stripEnd = chunkInfo.last_.x1_;
+		uint64_t firstChunk = chunkInfo.first_.x0_ / writeSize_;
+		uint64_t writeableTotal = 0;
+		for (uint32_t i = 0; i < numChunks; ++i){
+			auto &chunk = chunks[i];
+			bool firstSeam  = (i == 0) && chunkInfo.hasFirstSeam();
+			bool lastSeam   = (i == numChunks - 1) && chunkInfo.hasLastSeam();
+			chunk.offset_ = (firstChunk + i) * writeSize_;
+			chunk.len_ = std::min(writeSize_, fileLen() - chunk.offset_);
+			uint64_t writeableBegin = std::max(chunk.offset_, stripBegin);
+			uint64_t writeableEnd = std::min(chunk.offset_ + writeSize_, stripEnd);
+			chunk.writeableOffset_ = writeableBegin - chunk.offset_;
+			chunk.writeableLen_ = writeableEnd - writeableBegin;
+			assert(chunk.writeableLen_);
+			writeableTotal += chunk.writeableLen_;
+			chunk.seam_ = nullptr;
+			if (firstSeam || lastSeam){
+				uint32_t shareCount = stripAt(chunk.offset_ + chunk.len_ - 1) -
+										stripAt(chunk.offset_) + 1;
+				assert(shareCount > 1);
+				chunk.seam_ = seams_.get(firstChunk + i,
+											chunk.offset_,
+											chunk.len_,
+											shareCount,
+											writeSize_,
+											pool);
+			}
+		}
+
+		// validation
+		(void)strip;
+		(void)writeableTotal;
+		assert(stripLen(strip) == writeableTotal);
+		assert(chunks[numChunks-1].offset_ + chunks[numChunks-1].writeableOffset_ +
+					chunks[numChunks-1].writeableLen_ == stripEnd);
+	}
 	uint32_t numStrips_;
 	uint64_t packedRowBytes_;
 	uint32_t finalStripHeight_;
 	uint64_t headerSize_;
 	uint64_t writeSize_;
 	uint32_t finalStrip_;
-	Strip **strips_;
+	SeamWindow seams_;
 };
 
 }
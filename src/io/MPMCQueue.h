@@ -0,0 +1,112 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace io {
+
+/*
+ * Bounded lock-free queue with any number of producers and consumers.
+ *
+ * Each cell carries a sequence number which tells producers whether the cell
+ * is free for position pos (sequence == pos), and tells consumers whether
+ * the cell has been filled (sequence == pos + 1). Producers claim positions
+ * with a compare-and-swap on head_, and consumers with a compare-and-swap
+ * on tail_.
+ */
+template<typename T> class MPMCQueue
+{
+  public:
+	// capacity is rounded up to a power of two
+	explicit MPMCQueue(size_t capacity) : cells_(nullptr), mask_(0), head_(0), tail_(0)
+	{
+		size_t len = 2;
+		while (len < capacity)
+			len <<= 1;
+		cells_ = new Cell[len];
+		mask_ = len - 1;
+		for (size_t i = 0; i < len; ++i)
+			cells_[i].sequence_.store(i, std::memory_order_relaxed);
+	}
+	~MPMCQueue(){
+		delete[] cells_;
+	}
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+	// may be called from any thread. Returns false if queue is full
+	bool push(const T &item){
+		size_t pos = head_.load(std::memory_order_relaxed);
+		while (true) {
+			auto cell = cells_ + (pos & mask_);
+			size_t seq = cell->sequence_.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell->item_ = item;
+					cell->sequence_.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = head_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	// may be called from any thread. Returns false if queue is empty
+	bool pop(T &item){
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		while (true) {
+			auto cell = cells_ + (pos & mask_);
+			size_t seq = cell->sequence_.load(std::memory_order_acquire);
+			auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0) {
+				if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					item = cell->item_;
+					cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = tail_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+	// exact when called by the only consumer
+	bool empty(void) const{
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		auto cell = cells_ + (pos & mask_);
+		return cell->sequence_.load(std::memory_order_acquire) != pos + 1;
+	}
+  private:
+	struct Cell {
+		std::atomic<size_t> sequence_;
+		T item_;
+	};
+	Cell *cells_;
+	size_t mask_;
+	// producers and consumers work on separate cache lines
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+};
+
+}
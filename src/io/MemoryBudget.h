@@ -0,0 +1,128 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+
+#include "IOStats.h"
+#include "util.h"
+
+namespace io {
+
+/*
+ * A MemoryBudget bounds the buffer memory handed out by the buffer pools
+ * of an image : buffers being encoded, and buffers whose writes are in flight.
+ * Pools charge each buffer they hand out, and credit it when the buffer
+ * is reclaimed. Since pools only grow to serve what is handed out, this
+ * also bounds the memory held idle in pools.
+ *
+ * Charging never blocks : writers reserve room before they ask a pool
+ * for buffers, waiting for it if need be, and the pool then draws on the
+ * reservation rather than charging again. So a buffer can always be charged
+ * from a reclaim path.
+ */
+class MemoryBudget
+{
+  public:
+	explicit MemoryBudget(uint64_t bytes) : budget_(bytes),
+											used_(0),
+											releases_(0),
+											startNs_(0),
+											lastNs_(0),
+											area_(0)
+	{
+		stats_.budget_ = bytes;
+	}
+	// charge len bytes if they fit in budget, checking and charging under
+	// one lock so that concurrent writers can't together exceed the budget.
+	// A single request larger than the whole budget fits once nothing else
+	// is charged. Returns true if len was charged
+	bool tryReserve(uint64_t len){
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (used_ + len > budget_ && used_)
+			return false;
+		update(used_ + len);
+
+		return true;
+	}
+	void charge(uint64_t len){
+		std::lock_guard<std::mutex> lock(mutex_);
+		update(used_ + len);
+	}
+	void credit(uint64_t len){
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			update(used_ - std::min(used_, len));
+			releases_++;
+		}
+		cv_.notify_all();
+	}
+	// wait up to timeoutUs for a credit. Returns true if there was one
+	bool waitForCredit(uint64_t timeoutUs){
+		std::unique_lock<std::mutex> lock(mutex_);
+		uint64_t releases = releases_;
+		return cv_.wait_for(lock, std::chrono::microseconds(timeoutUs),
+				[this, releases] { return releases_ != releases; });
+	}
+	// writer waited waitNs for room, and was let through anyway if overrun
+	void addWait(uint64_t waitNs, bool overrun){
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats_.waits_++;
+		stats_.waitNs_ += waitNs;
+		if (overrun)
+			stats_.overruns_++;
+	}
+	BudgetStats getStats(void){
+		std::lock_guard<std::mutex> lock(mutex_);
+		update(used_);
+		auto stats = stats_;
+		if (lastNs_ > startNs_)
+			stats.averageBytes_ = (uint64_t)(area_ / (double)(lastNs_ - startNs_));
+
+		return stats;
+	}
+  private:
+	// called with mutex held : accumulate time weighted use
+	void update(uint64_t used){
+		uint64_t now = nowNs();
+		if (!startNs_)
+			startNs_ = now;
+		else
+			area_ += (double)used_ * (double)(now - lastNs_);
+		lastNs_ = now;
+		used_ = used;
+		stats_.peakBytes_ = std::max(stats_.peakBytes_, used_);
+	}
+	uint64_t budget_;
+	uint64_t used_;
+	uint64_t releases_;
+	uint64_t startNs_;
+	uint64_t lastNs_;
+	// integral of bytes in use over time, in byte ns
+	double area_;
+	BudgetStats stats_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+};
+
+}
@@ -0,0 +1,221 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "NumaTopology.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace io {
+
+#ifdef __linux__
+
+// memory policy system calls are called directly, so libnuma is not required
+static long setMempolicy(int mode, const unsigned long *nodemask, unsigned long maxnode){
+	return syscall(__NR_set_mempolicy, mode, nodemask, maxnode);
+}
+static long mbindRange(void *addr, unsigned long len, int mode,
+						const unsigned long *nodemask, unsigned long maxnode, unsigned flags){
+	return syscall(__NR_mbind, addr, len, mode, nodemask, maxnode, flags);
+}
+static long getMempolicy(int *mode, unsigned long *nodemask, unsigned long maxnode,
+							const void *addr, unsigned long flags){
+	return syscall(__NR_get_mempolicy, mode, nodemask, maxnode, addr, flags);
+}
+
+// largest kernel node id supported by node masks
+const int32_t maxNumaNodeId = 1023;
+const unsigned long bitsPerMaskWord = 8 * sizeof(unsigned long);
+
+// parse a sysfs cpu list such as "0-3,8-11"
+static std::vector<uint32_t> parseCpuList(const char *list){
+	std::vector<uint32_t> cpus;
+	const char *p = list;
+	while (*p >= '0' && *p <= '9'){
+		char *end;
+		auto first = strtoul(p, &end, 10);
+		auto last = first;
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+		for (auto cpu = first; cpu <= last; ++cpu)
+			cpus.push_back((uint32_t)cpu);
+		if (*end != ',')
+			break;
+		p = end + 1;
+	}
+
+	return cpus;
+}
+
+bool discoverNumaTopology(NumaTopology &topology){
+	topology.nodeIds_.clear();
+	topology.cpus_.clear();
+	std::vector<int32_t> ids;
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (dir) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != nullptr){
+			int id;
+			if (sscanf(entry->d_name, "node%d", &id) == 1 && id >= 0 && id <= maxNumaNodeId)
+				ids.push_back(id);
+		}
+		closedir(dir);
+	}
+	std::sort(ids.begin(), ids.end());
+	for (auto id : ids){
+		char path[256];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+		char list[4096];
+		std::vector<uint32_t> cpus;
+		if (fgets(list, sizeof(list), f))
+			cpus = parseCpuList(list);
+		fclose(f);
+		// memory-only nodes have no workers
+		if (cpus.empty())
+			continue;
+		topology.nodeIds_.push_back(id);
+		topology.cpus_.push_back(cpus);
+	}
+	if (!topology.nodeIds_.empty())
+		return true;
+	// no NUMA support : a single node holds every cpu
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numCpus <= 0)
+		return false;
+	std::vector<uint32_t> cpus;
+	for (uint32_t cpu = 0; cpu < (uint32_t)numCpus; ++cpu)
+		cpus.push_back(cpu);
+	topology.nodeIds_.push_back(0);
+	topology.cpus_.push_back(cpus);
+
+	return true;
+}
+uint32_t numaNodeOfWorker(const NumaTopology &topology, uint32_t worker,
+							uint32_t concurrency){
+	uint64_t totalCpus = 0;
+	for (auto &cpus : topology.cpus_)
+		totalCpus += cpus.size();
+	if (!totalCpus || !concurrency)
+		return 0;
+	// position of worker in the list of all cpus, ordered by node
+	uint64_t cpu = ((uint64_t)worker * totalCpus) / concurrency;
+	for (uint32_t node = 0; node < topology.numNodes(); ++node){
+		if (cpu < topology.cpus_[node].size())
+			return node;
+		cpu -= topology.cpus_[node].size();
+	}
+
+	return topology.numNodes() - 1;
+}
+bool bindThreadToNumaNode(const NumaTopology &topology, uint32_t node,
+							std::thread::native_handle_type thread){
+	if (node >= topology.numNodes())
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto cpu : topology.cpus_[node]){
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &set);
+	}
+
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+// node mask with a single kernel node id set
+static void nodeMask(unsigned long *mask, int32_t nodeId){
+	memset(mask, 0, (maxNumaNodeId + 1) / 8);
+	mask[(unsigned long)nodeId / bitsPerMaskWord] |= 1UL << ((unsigned long)nodeId % bitsPerMaskWord);
+}
+bool preferNumaNode(const NumaTopology &topology, uint32_t node){
+	if (node >= topology.numNodes())
+		return false;
+	unsigned long mask[(maxNumaNodeId + 1) / bitsPerMaskWord];
+	nodeMask(mask, topology.nodeIds_[node]);
+
+	return setMempolicy(MPOL_PREFERRED, mask, maxNumaNodeId + 1) == 0;
+}
+bool bindMemoryToNumaNode(const NumaTopology &topology, uint32_t node,
+							void *addr, uint64_t len){
+	if (node >= topology.numNodes())
+		return false;
+	unsigned long mask[(maxNumaNodeId + 1) / bitsPerMaskWord];
+	nodeMask(mask, topology.nodeIds_[node]);
+
+	// preferred rather than strict binding, so a full node doesn't fail allocation
+	return mbindRange(addr, len, MPOL_PREFERRED, mask, maxNumaNodeId + 1, MPOL_MF_MOVE) == 0;
+}
+int32_t numaNodeOfAddress(const void *addr){
+	int nodeId = -1;
+	if (getMempolicy(&nodeId, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+		return -1;
+
+	return nodeId;
+}
+
+#else
+
+bool discoverNumaTopology(NumaTopology &topology){
+	(void)topology;
+	return false;
+}
+uint32_t numaNodeOfWorker(const NumaTopology &topology, uint32_t worker,
+							uint32_t concurrency){
+	(void)topology;
+	(void)worker;
+	(void)concurrency;
+	return 0;
+}
+bool bindThreadToNumaNode(const NumaTopology &topology, uint32_t node,
+							std::thread::native_handle_type thread){
+	(void)topology;
+	(void)node;
+	(void)thread;
+	return false;
+}
+bool preferNumaNode(const NumaTopology &topology, uint32_t node){
+	(void)topology;
+	(void)node;
+	return false;
+}
+bool bindMemoryToNumaNode(const NumaTopology &topology, uint32_t node,
+							void *addr, uint64_t len){
+	(void)topology;
+	(void)node;
+	(void)addr;
+	(void)len;
+	return false;
+}
+int32_t numaNodeOfAddress(const void *addr){
+	(void)addr;
+	return -1;
+}
+
+#endif
+
+}
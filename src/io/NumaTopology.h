@@ -0,0 +1,68 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+
+namespace io {
+
+/*
+ * Memory nodes of the system, and the cpus local to each node.
+ * Nodes are indexed densely, in order of their kernel node ids,
+ * which may be sparse.
+ */
+struct NumaTopology {
+	uint32_t numNodes(void) const{
+		return (uint32_t)nodeIds_.size();
+	}
+	// kernel node id of each node
+	std::vector<int32_t> nodeIds_;
+	// cpus of each node
+	std::vector<std::vector<uint32_t>> cpus_;
+};
+
+/*
+ * Discover memory nodes with cpus, from sysfs. A system without NUMA
+ * support is reported as a single node holding every cpu.
+ *
+ * Returns false if nothing could be discovered.
+ */
+bool discoverNumaTopology(NumaTopology &topology);
+
+// index of node serving worker : workers are grouped on nodes in proportion
+// to each node's number of cpus
+uint32_t numaNodeOfWorker(const NumaTopology &topology, uint32_t worker,
+							uint32_t concurrency);
+
+// run thread on cpus of node
+bool bindThreadToNumaNode(const NumaTopology &topology, uint32_t node,
+							std::thread::native_handle_type thread);
+
+// prefer node for memory first touched by calling thread
+bool preferNumaNode(const NumaTopology &topology, uint32_t node);
+
+// place pages of [addr, addr + len) on node. addr must be page aligned
+bool bindMemoryToNumaNode(const NumaTopology &topology, uint32_t node,
+							void *addr, uint64_t len);
+
+// kernel node id of page holding addr, or -1 if unknown
+int32_t numaNodeOfAddress(const void *addr);
+
+}
@@ -0,0 +1,162 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "config.h"
+
+#ifdef IOBENCH_HAVE_URING
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "RingAggregator.h"
+
+namespace io {
+
+// largest ring created for an aggregator
+const uint32_t maxAggregatorDepth = 4096;
+
+RingAggregator::RingAggregator(const IOParams &params, uint32_t numWorkers) :
+		ring_(numWorkers), eventFd_(-1), waiting_(false), stop_(false)
+{
+	uint32_t queueDepth = std::max<uint32_t>(params.queueDepth_, 1);
+	for (uint32_t i = 0; i < numWorkers; ++i)
+		queues_.push_back(new SPSCQueue<IOScheduleData*>(queueDepth));
+	// ring is deep enough to keep every worker's queue in flight
+	auto ringParams = params;
+	ringParams.queueDepth_ = std::min<uint32_t>(queueDepth * std::max<uint32_t>(numWorkers, 1),
+												maxAggregatorDepth);
+	ring_.setIOParams(ringParams);
+}
+RingAggregator::~RingAggregator(){
+	close();
+	for (auto q : queues_)
+		delete q;
+}
+bool RingAggregator::attach(std::string fileName, std::string mode, int fd){
+	if (!ring_.attach(fileName, mode, fd, 0))
+		return false;
+	eventFd_ = eventfd(0, EFD_CLOEXEC);
+	if (eventFd_ < 0){
+		printf("eventfd: %s\n", strerror(errno));
+		return false;
+	}
+	int ret = io_uring_register_eventfd(&ring_.ring, eventFd_);
+	if (ret < 0){
+		printf("io_uring_register_eventfd: %s\n", strerror(-ret));
+		::close(eventFd_);
+		eventFd_ = -1;
+		return false;
+	}
+	thread_ = std::thread(&RingAggregator::run, this);
+
+	return true;
+}
+const IOStats& RingAggregator::getStats(void) const{
+	return ring_.getStats();
+}
+uint32_t RingAggregator::queueDepth(void) const{
+	return ring_.params_.queueDepth_;
+}
+bool RingAggregator::push(uint32_t threadId, IOScheduleData *data){
+	if (!queues_[threadId]->push(data))
+		return false;
+	// pairs with fence in run() : either producer sees waiting flag,
+	// or submission thread sees request before it waits
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting_)
+		wake();
+
+	return true;
+}
+void RingAggregator::wake(void){
+	eventfd_write(eventFd_, 1);
+}
+// submission thread only
+bool RingAggregator::empty(void) const{
+	for (auto q : queues_){
+		if (!q->empty())
+			return false;
+	}
+
+	return true;
+}
+// issue all queued requests, visiting workers round robin.
+// Returns number of requests issued
+uint32_t RingAggregator::drain(void){
+	uint32_t count = 0;
+	bool more = true;
+	while (more) {
+		more = false;
+		for (auto q : queues_){
+			IOScheduleData *data;
+			if (q->pop(data)) {
+				ring_.issue(data);
+				count++;
+				more = true;
+			}
+		}
+	}
+
+	return count;
+}
+// issue queued requests and reap completions, without blocking on either :
+// the thread only waits once there is nothing to issue or reap
+void RingAggregator::run(void){
+	while (true) {
+		if (drain()) {
+			// submit whatever the batching thresholds have held back
+			ring_.flush();
+			continue;
+		}
+		bool inFlight = ring_.inFlight();
+		if (inFlight && ring_.processCompletion(true, false)) {
+			while (ring_.processCompletion(true, false));
+			continue;
+		}
+		if (stop_ && !inFlight && empty())
+			return;
+		waiting_ = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		// a completion posted after the peek above has signalled the eventfd
+		if (empty() && !stop_) {
+			eventfd_t val;
+			eventfd_read(eventFd_, &val);
+		}
+		waiting_ = false;
+	}
+}
+bool RingAggregator::close(void){
+	if (thread_.joinable()) {
+		stop_ = true;
+		wake();
+		thread_.join();
+	}
+	if (eventFd_ != -1){
+		io_uring_unregister_eventfd(&ring_.ring);
+		::close(eventFd_);
+		eventFd_ = -1;
+	}
+
+	return ring_.close();
+}
+
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "config.h"
+#ifdef IOBENCH_HAVE_URING
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "FileIOUring.h"
+#include "IOParams.h"
+#include "IOStats.h"
+#include "SPSCQueue.h"
+
+namespace io {
+
+/*
+ * A RingAggregator owns a single submission thread and a single large ring,
+ * which issue the asynchronous writes of all workers, in place of one ring
+ * per worker. Each worker feeds the thread through its own lock-free queue.
+ * Requests are handed over with a completion callback, which the thread
+ * calls once the request is complete, so that buffers return to the pool
+ * of the worker that issued them.
+ *
+ * The thread waits on an eventfd registered with the ring, which the kernel
+ * signals when a completion is posted, and which workers signal when they
+ * queue a request while the thread waits. Requests are thus issued while
+ * earlier writes are still in flight.
+ */
+class RingAggregator
+{
+  public:
+	// one queue per worker, each holding up to queueDepth_ requests
+	RingAggregator(const IOParams &params, uint32_t numWorkers);
+	~RingAggregator();
+	// attach ring to file and start submission thread
+	bool attach(std::string fileName, std::string mode, int fd);
+	// called by worker threadId only. Returns false if worker's queue is full
+	bool push(uint32_t threadId, IOScheduleData *data);
+	// wait for all requests to complete and stop submission thread.
+	// Returns false if any request failed
+	bool close(void);
+	const IOStats& getStats(void) const;
+	uint32_t queueDepth(void) const;
+
+  private:
+	void run(void);
+	uint32_t drain(void);
+	bool empty(void) const;
+	void wake(void);
+
+	FileIOUring ring_;
+	std::vector<SPSCQueue<IOScheduleData*>*> queues_;
+	// signalled by completions and by workers
+	int eventFd_;
+	std::atomic<bool> waiting_;
+	std::atomic<bool> stop_;
+	std::thread thread_;
+};
+
+}
+
+#endif
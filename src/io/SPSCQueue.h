@@ -0,0 +1,80 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace io {
+
+/*
+ * Bounded lock-free queue with a single producer and a single consumer.
+ * The producer owns head_ and the consumer owns tail_ : each side only
+ * reads the other's index to check for a full or an empty queue.
+ */
+template<typename T> class SPSCQueue
+{
+  public:
+	// capacity is rounded up to a power of two
+	explicit SPSCQueue(size_t capacity) : items_(nullptr), mask_(0), head_(0), tail_(0)
+	{
+		size_t len = 1;
+		while (len < capacity)
+			len <<= 1;
+		items_ = new T[len];
+		mask_ = len - 1;
+	}
+	~SPSCQueue(){
+		delete[] items_;
+	}
+	SPSCQueue(const SPSCQueue&) = delete;
+	SPSCQueue& operator=(const SPSCQueue&) = delete;
+	// producer only. Returns false if queue is full
+	bool push(const T &item){
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) > mask_)
+			return false;
+		items_[head & mask_] = item;
+		head_.store(head + 1, std::memory_order_release);
+
+		return true;
+	}
+	// consumer only. Returns false if queue is empty
+	bool pop(T &item){
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire))
+			return false;
+		item = items_[tail & mask_];
+		tail_.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+	// consumer only
+	bool empty(void) const{
+		return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_acquire);
+	}
+  private:
+	T *items_;
+	size_t mask_;
+	// producer and consumer work on separate cache lines
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+};
+
+}
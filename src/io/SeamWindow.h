@@ -0,0 +1,162 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "IBufferPool.h"
+
+namespace io {
+
+// initial number of slots in a SeamWindow : a power of two
+const uint64_t initialSeamSlots = 64;
+
+/*
+ * A seam chunk is shared by neighbouring strips. Its buffer is written
+ * by the last strip to acquire it.
+ */
+struct ChunkSeam {
+	ChunkSeam() : chunk_(0),
+				buf_(nullptr),
+				shareCount_(0),
+				acquireCount_(0),
+				next_(nullptr)
+	{}
+	// share count is read before acquiring : once every sharer has acquired
+	// the seam, it may be released and recycled for another chunk
+	bool acquire(void){
+		auto shareCount = shareCount_;
+		return (++acquireCount_ == shareCount);
+	}
+	// index of chunk in file
+	uint64_t chunk_;
+	IOBuf *buf_;
+	uint32_t shareCount_;
+	std::atomic<uint32_t> acquireCount_;
+	// next seam in free list
+	ChunkSeam *next_;
+};
+
+/*
+ * Seams of the strips being encoded, keyed by chunk index. A seam, and its
+ * buffer, are created when the first strip sharing it is requested, and
+ * the seam is released once every strip sharing it has acquired it. The
+ * live seams thus span a window of chunks that slides along the image with
+ * the strips being encoded.
+ *
+ * The window is direct mapped on chunk index, and doubles whenever two live
+ * seams collide, i.e. when strips are encoded far out of order. Released
+ * seams are recycled, so a window that has reached its working size no
+ * longer allocates.
+ */
+class SeamWindow
+{
+  public:
+	SeamWindow() : slots_(new ChunkSeam*[initialSeamSlots]()),
+					numSlots_(initialSeamSlots),
+					free_(nullptr),
+					live_(0),
+					peak_(0)
+	{}
+	~SeamWindow(){
+		// buffers of live seams were never written
+		for (uint64_t i = 0; i < numSlots_; ++i){
+			if (slots_[i]){
+				RefReaper::unref(slots_[i]->buf_);
+				delete slots_[i];
+			}
+		}
+		delete[] slots_;
+		while (free_){
+			auto next = free_->next_;
+			delete free_;
+			free_ = next;
+		}
+	}
+	// get seam of chunk, creating it with a buffer of length len from pool
+	// if no strip sharing it has been requested yet
+	ChunkSeam* get(uint64_t chunk, uint64_t offset, uint64_t len,
+					uint32_t shareCount, uint64_t allocLen, IBufferPool *pool){
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (slot(chunk) && slot(chunk)->chunk_ != chunk)
+			grow();
+		auto &seam = slot(chunk);
+		if (seam)
+			return seam;
+		if (free_){
+			seam = free_;
+			free_ = free_->next_;
+		} else {
+			seam = new ChunkSeam();
+		}
+		seam->chunk_ = chunk;
+		seam->shareCount_ = shareCount;
+		seam->acquireCount_ = 0;
+		seam->next_ = nullptr;
+		seam->buf_ = pool->get(allocLen);
+		seam->buf_->updateLen(len);
+		seam->buf_->offset_ = offset;
+		seam->buf_->skip_ = 0;
+		peak_ = std::max(peak_, ++live_);
+
+		return seam;
+	}
+	// called once every strip sharing seam has acquired it
+	void release(ChunkSeam *seam){
+		std::unique_lock<std::mutex> lock(mutex_);
+		assert(slot(seam->chunk_) == seam);
+		slot(seam->chunk_) = nullptr;
+		seam->buf_ = nullptr;
+		seam->next_ = free_;
+		free_ = seam;
+		live_--;
+	}
+	// largest number of seams live at once
+	uint64_t peak(void){
+		std::unique_lock<std::mutex> lock(mutex_);
+		return peak_;
+	}
+  private:
+	ChunkSeam*& slot(uint64_t chunk){
+		return slots_[chunk & (numSlots_ - 1)];
+	}
+	// double window : live seams keep distinct slots
+	void grow(void){
+		auto oldSlots = slots_;
+		uint64_t oldNumSlots = numSlots_;
+		numSlots_ *= 2;
+		slots_ = new ChunkSeam*[numSlots_]();
+		for (uint64_t i = 0; i < oldNumSlots; ++i){
+			if (oldSlots[i])
+				slot(oldSlots[i]->chunk_) = oldSlots[i];
+		}
+		delete[] oldSlots;
+	}
+	std::mutex mutex_;
+	ChunkSeam **slots_;
+	uint64_t numSlots_;
+	ChunkSeam *free_;
+	uint64_t live_;
+	uint64_t peak_;
+};
+
+}
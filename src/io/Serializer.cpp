@@ -32,7 +32,11 @@ static bool applicationReclaimCallback(uint32_t threadId,
 }
 
 Serializer::Serializer(uint32_t threadId, bool flushOnClose) :
-	  pool_(new BufferPool()),
+		Serializer(threadId, flushOnClose, nullptr)
+{}
+Serializer::Serializer(uint32_t threadId, bool flushOnClose, BufferArena *arena) :
+	  pool_(new BufferPool(arena)),
+	  arena_(arena),
 	  fileIO_(threadId, flushOnClose),
 	  threadId_(threadId)
 {
@@ -51,14 +55,69 @@ void Serializer::registerReclaimCallback(io_callback reclaim_callback,
 {
 	fileIO_.registerReclaimCallback(reclaim_callback, user_data);
 }
+void Serializer::setIOParams(const IOParams &params){
+	fileIO_.setIOParams(params);
+	pool_->setAlignment(params.alignment_);
+	pool_->setNumaSampling(params.numa_);
+}
+IOStats Serializer::getStats(void) const{
+	return fileIO_.getStats();
+}
+bool Serializer::flush(void){
+	return fileIO_.flush();
+}
+bool Serializer::poll(void){
+	return fileIO_.poll();
+}
 IOBuf* Serializer::getPoolBuffer(uint64_t len){
 	return pool_->get(len);
 }
+IOBuf* Serializer::getMappedBuffer(uint64_t offset, uint64_t len){
+	return fileIO_.getMappedBuffer(offset, len);
+}
+PoolStats Serializer::getPoolStats(void) const{
+	return pool_->getStats();
+}
+// stock pool with count buffers, and engine with as many requests
+void Serializer::prewarmPool(uint32_t count, uint64_t len, uint32_t buffersPerRequest){
+	pool_->prewarm(count, len);
+	fileIO_.prewarmRequests(count, buffersPerRequest);
+}
 IBufferPool* Serializer::getPool(void){
 	return pool_;
 }
 bool Serializer::attach(Serializer *parent){
-	return fileIO_.attach(&parent->fileIO_);
+	pool_->setAlignment(parent->pool_->alignment());
+	pool_->setNumaSampling(parent->pool_->numaSampling());
+	if (!fileIO_.attach(&parent->fileIO_))
+		return false;
+	// fall back to regular writes if arena can't be registered
+	if (arena_)
+		fileIO_.registerBuffers(arena_);
+
+	return true;
+}
+bool Serializer::setCompletionReaper(CompletionReaper *reaper){
+	return fileIO_.setCompletionReaper(reaper);
+}
+void Serializer::setWriteOffloader(WriteOffloader *offloader){
+	fileIO_.setWriteOffloader(offloader);
+}
+void Serializer::setBufferDepot(BufferDepot *depot){
+	pool_->setDepot(depot);
+}
+void Serializer::setMemoryBudget(MemoryBudget *budget){
+	pool_->setBudget(budget);
+}
+// len bytes were reserved in memory budget for the next pool buffers
+void Serializer::reserveBudget(uint64_t len){
+	pool_->reserve(len);
+}
+void Serializer::releaseBudgetReservation(void){
+	pool_->releaseReservation();
+}
+bool Serializer::attachRingAggregator(RingAggregator *aggregator){
+	return fileIO_.attachRingAggregator(aggregator);
 }
 bool Serializer::open(std::string name, std::string mode, bool asynch)
 {
@@ -68,6 +127,12 @@ bool Serializer::close(void)
 {
 	return fileIO_.close();
 }
+bool Serializer::allocate(uint64_t len, bool preallocate){
+	return fileIO_.allocate(len, preallocate);
+}
+bool Serializer::map(uint64_t len){
+	return fileIO_.map(len);
+}
 bool Serializer::reopenAsBuffered(void){
 	return fileIO_.reopenAsBuffered();
 }
@@ -31,21 +31,39 @@ class Serializer
 {
 public:
 	Serializer(uint32_t threadId, bool flushOnClose);
+	Serializer(uint32_t threadId, bool flushOnClose, BufferArena *arena);
 	~Serializer(void);
 	void setMaxSimulatedWrites(uint64_t maxRequests);
 	void registerReclaimCallback(io_callback reclaim_callback, void* user_data);
+	void setIOParams(const IOParams &params);
+	IOStats getStats(void) const;
+	bool flush(void);
+	bool poll(void);
 	bool attach(Serializer *parent);
+	bool setCompletionReaper(CompletionReaper *reaper);
+	void setWriteOffloader(WriteOffloader *offloader);
+	void setBufferDepot(BufferDepot *depot);
+	void setMemoryBudget(MemoryBudget *budget);
+	void reserveBudget(uint64_t len);
+	void releaseBudgetReservation(void);
+	bool attachRingAggregator(RingAggregator *aggregator);
 	bool open(std::string name, std::string mode, bool asynch);
 	bool close(void);
+	bool allocate(uint64_t len, bool preallocate);
+	bool map(uint64_t len);
 	bool reopenAsBuffered(void);
 	uint64_t write(uint64_t offset, IOBuf **buffers, uint32_t numBuffers);
 	uint64_t write(uint8_t* buf, uint64_t size);
 	uint64_t seek(int64_t off, int32_t whence);
 	IOBuf* getPoolBuffer(uint64_t len);
+	IOBuf* getMappedBuffer(uint64_t offset, uint64_t len);
 	IBufferPool* getPool(void);
+	PoolStats getPoolStats(void) const;
+	void prewarmPool(uint32_t count, uint64_t len, uint32_t buffersPerRequest);
 	void enableSimulateWrite(void);
 private:
-	IBufferPool *pool_;
+	BufferPool *pool_;
+	BufferArena *arena_;
 	FileIOUnix fileIO_;
 	uint32_t threadId_;
 };
@@ -0,0 +1,102 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "StorageGeometry.h"
+
+#include <cstdio>
+#include <algorithm>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace io {
+
+#ifdef __linux__
+
+// read a block device queue limit from sysfs. Partitions have no queue
+// directory of their own, so fall back to the parent device's.
+static uint64_t readQueueLimit(dev_t dev, const char *name){
+	const char *formats[] = {"/sys/dev/block/%u:%u/queue/%s",
+							"/sys/dev/block/%u:%u/../queue/%s"};
+	for (auto format : formats){
+		char path[256];
+		snprintf(path, sizeof(path), format, major(dev), minor(dev), name);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+		unsigned long long val = 0;
+		int ret = fscanf(f, "%llu", &val);
+		fclose(f);
+		if (ret == 1)
+			return val;
+	}
+
+	return 0;
+}
+
+bool discoverStorageGeometry(const std::string &path, StorageGeometry &geometry){
+	// file may not exist yet : use its directory instead
+	std::string target = path;
+	struct stat st;
+	if (stat(target.c_str(), &st) != 0) {
+		auto slash = path.find_last_of('/');
+		target = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+		if (stat(target.c_str(), &st) != 0)
+			return false;
+	}
+	bool discovered = false;
+	uint64_t alignment = 0;
+#ifdef STATX_DIOALIGN
+	struct statx stx;
+	if (statx(AT_FDCWD, target.c_str(), 0, STATX_DIOALIGN, &stx) == 0 &&
+			(stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align)
+		alignment = std::max(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
+#endif
+	if (!alignment)
+		alignment = readQueueLimit(st.st_dev, "logical_block_size");
+	// alignment must be a power of two
+	if (alignment && !(alignment & (alignment - 1))) {
+		geometry.alignment_ = std::max<uint64_t>(alignment, sizeof(void*));
+		discovered = true;
+	}
+	uint64_t writeSize = std::max<uint64_t>(defaultWriteSize, (uint64_t)st.st_blksize);
+	uint64_t minimumIO = readQueueLimit(st.st_dev, "minimum_io_size");
+	uint64_t optimalIO = readQueueLimit(st.st_dev, "optimal_io_size");
+	if (minimumIO || optimalIO)
+		discovered = true;
+	writeSize = std::max(writeSize, std::min(minimumIO, maxDiscoveredWriteSize));
+	writeSize = std::max(writeSize, std::min(optimalIO, maxDiscoveredWriteSize));
+	geometry.writeSize_ = ((writeSize + geometry.alignment_ - 1) / geometry.alignment_) *
+							geometry.alignment_;
+
+	return discovered;
+}
+
+#else
+
+bool discoverStorageGeometry(const std::string &path, StorageGeometry &geometry){
+	(void)path;
+	(void)geometry;
+
+	return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,56 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "IFileIO.h"
+
+namespace io {
+
+/*
+ * Direct I/O alignment and preferred write size of the storage
+ * holding a file.
+ */
+struct StorageGeometry {
+	StorageGeometry() : alignment_(defaultAlignment),
+						writeSize_(defaultWriteSize)
+	{}
+	// alignment of O_DIRECT buffer memory, file offsets and lengths
+	uint64_t alignment_;
+	// preferred write size : a multiple of alignment_
+	uint64_t writeSize_;
+};
+
+// largest write size adopted from the block device's optimal I/O size
+const uint64_t maxDiscoveredWriteSize = 8 * K * K;
+
+/*
+ * Discover storage geometry of the file system holding path, which need
+ * not exist yet. Alignment is taken from statx(STATX_DIOALIGN), or else from
+ * the block device's logical block size. Write size is the largest of
+ * the default write size, st_blksize, and the block device's minimum and
+ * optimal I/O sizes (i.e. RAID chunk and stripe width), rounded up to
+ * a multiple of the alignment.
+ *
+ * Returns false if nothing could be discovered, leaving defaults in place.
+ */
+bool discoverStorageGeometry(const std::string &path, StorageGeometry &geometry);
+
+}
@@ -76,8 +76,7 @@ TIFFFormat::TIFFFormat(bool flushOnClose) :
 
 bool TIFFFormat::close(void){
 	// wait for asynch writes to complete
-	if (!closeThreadSerializers())
-		return false;
+	bool rc = closeThreadSerializers();
 
 	// close TIFF
 	if(tif_) {
@@ -85,11 +84,9 @@ bool TIFFFormat::close(void){
 		tif_ = nullptr;
 	}
 
-	if (!ImageFormat::close())
-		return false;
-
+	rc &= ImageFormat::close();
 
-	return true;
+	return rc;
 }
 bool TIFFFormat::encodeHeader(void){
 	if(isHeaderEncoded())
@@ -118,6 +115,11 @@ bool TIFFFormat::encodeFinish(void)
 	if(filename_.empty() || (encodeState_ & IMAGE_FORMAT_ENCODED_PIXELS))
 		return true;
 
+	// the shared file descriptor is closed and reopened below, so every
+	// worker's writes must be complete first, including writes still
+	// queued on I/O threads, the ring aggregator or a batch
+	if (!closeThreadSerializers())
+		return false;
 	if (!reopenAsBuffered())
 		return false;
 
@@ -135,14 +137,16 @@ bool TIFFFormat::encodeFinish(void)
 	//2. simulate strip writes
 	for(uint32_t j = 0; j < imageStripper_->numStrips(); ++j){
 		tmsize_t written =
-			TIFFWriteEncodedStrip(tif_, (uint32_t)j, nullptr, (tmsize_t)imageStripper_->getStrip(j)->logicalLen_);
+			TIFFWriteEncodedStrip(tif_, (uint32_t)j, nullptr, (tmsize_t)imageStripper_->stripLen(j));
 		if (written == -1){
 			printf("Error writing strip\n");
 			return false;
 		}
 	}
-	close();
+	bool rc = close();
 	encodeState_ |= IMAGE_FORMAT_ENCODED_PIXELS;
+	if (!rc)
+		return false;
 
 	return encodeFinisher_ ? encodeFinisher_() : true;
 }
@@ -0,0 +1,194 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+namespace io {
+
+/*
+ * Write-behind for buffered writes: as soon as a write completes, writeback
+ * of its range is started with sync_file_range. Once more than window bytes
+ * are under writeback, the oldest ranges are waited on, and optionally
+ * dropped from the page cache. This keeps dirty memory bounded, so that
+ * close does not pay for one giant fsync.
+ *
+ * Completed writes may be reported from several threads, i.e. completion
+ * reapers and I/O threads, so ranges are taken off the ring under the lock,
+ * but waited on without it : a reporter only ever blocks on writeback of
+ * the ranges it retires itself.
+ * Ranges under writeback are held in a ring that only grows, so that
+ * reporting a write doesn't allocate once the window is full.
+ */
+class WriteBehind
+{
+  public:
+	WriteBehind() : fd_(-1), windowBytes_(0), dropCache_(false), pendingBytes_(0),
+					head_(0), numRanges_(0), retiring_(0), failed_(false)
+	{}
+	// zero window disables write-behind
+	void init(int fd, uint64_t windowBytes, bool dropCache){
+		std::lock_guard<std::mutex> lock(mutex_);
+		fd_ = fd;
+		windowBytes_ = windowBytes;
+		dropCache_ = dropCache;
+		failed_ = false;
+	}
+	void written(uint64_t offset, uint64_t len){
+#ifdef __linux__
+		int fd;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (fd_ == -1 || !windowBytes_ || !len)
+				return;
+			fd = fd_;
+		}
+		if (sync_file_range(fd, (off64_t)offset, (off64_t)len, SYNC_FILE_RANGE_WRITE) != 0)
+			fail("start", offset, len);
+		Range r;
+		bool dropCache;
+		std::unique_lock<std::mutex> lock(mutex_);
+		push({offset, len});
+		pendingBytes_ += len;
+		while (pop(r)) {
+			dropCache = dropCache_;
+			lock.unlock();
+			retire(fd, r, dropCache);
+			lock.lock();
+			retired();
+		}
+#else
+		(void)offset;
+		(void)len;
+#endif
+	}
+	// wait for writeback of all ranges. Returns false if writeback of
+	// any range failed
+	bool finish(void){
+#ifdef __linux__
+		std::unique_lock<std::mutex> lock(mutex_);
+		int fd = fd_;
+		bool dropCache = dropCache_;
+		Range r;
+		while (numRanges_) {
+			r = take();
+			lock.unlock();
+			retire(fd, r, dropCache);
+			lock.lock();
+			retired();
+		}
+		// ranges retired by reporters
+		cv_.wait(lock, [this] { return retiring_ == 0; });
+		fd_ = -1;
+		bool rc = !failed_;
+		failed_ = false;
+
+		return rc;
+#else
+		return true;
+#endif
+	}
+  private:
+	struct Range {
+		uint64_t offset_;
+		uint64_t len_;
+	};
+	// append range to ring, doubling ring if it is full
+	void push(const Range &range){
+		if (numRanges_ == ranges_.size()) {
+			std::vector<Range> ranges(std::max<size_t>(2 * ranges_.size(), 16));
+			for (size_t i = 0; i < numRanges_; ++i)
+				ranges[i] = ranges_[(head_ + i) % ranges_.size()];
+			ranges_.swap(ranges);
+			head_ = 0;
+		}
+		ranges_[(head_ + numRanges_) % ranges_.size()] = range;
+		numRanges_++;
+	}
+	// called with mutex held : take oldest range off ring, to be retired
+	Range take(void){
+		auto r = ranges_[head_];
+		head_ = (head_ + 1) % ranges_.size();
+		numRanges_--;
+		pendingBytes_ -= r.len_;
+		retiring_++;
+
+		return r;
+	}
+	// called with mutex held : take oldest range off ring if more than
+	// window bytes are under writeback
+	bool pop(Range &r){
+		if (pendingBytes_ <= windowBytes_ || !numRanges_)
+			return false;
+		r = take();
+
+		return true;
+	}
+	// called with mutex held, once a range taken off ring is retired
+	void retired(void){
+		if (--retiring_ == 0)
+			cv_.notify_all();
+	}
+	// wait for writeback of range, without mutex
+	void retire(int fd, const Range &r, bool dropCache){
+#ifdef __linux__
+		if (sync_file_range(fd, (off64_t)r.offset_, (off64_t)r.len_,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+			fail("wait for", r.offset_, r.len_);
+			return;
+		}
+		if (dropCache)
+			posix_fadvise(fd, (off_t)r.offset_, (off_t)r.len_, POSIX_FADV_DONTNEED);
+#else
+		(void)fd;
+		(void)r;
+		(void)dropCache;
+#endif
+	}
+	// called without mutex held
+	void fail(const char *what, uint64_t offset, uint64_t len){
+		printf("sync_file_range : failed to %s writeback of %lu bytes at offset %lu : %s\n",
+				what, len, offset, strerror(errno));
+		std::lock_guard<std::mutex> lock(mutex_);
+		failed_ = true;
+	}
+	int fd_;
+	uint64_t windowBytes_;
+	bool dropCache_;
+	uint64_t pendingBytes_;
+	// ring of ranges under writeback, oldest first
+	std::vector<Range> ranges_;
+	size_t head_;
+	size_t numRanges_;
+	// number of ranges taken off ring, and still being waited on
+	uint32_t retiring_;
+	bool failed_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+};
+}
@@ -0,0 +1,82 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WIN32
+
+#include <algorithm>
+
+#include "WriteOffloader.h"
+#include "FileIOUnix.h"
+
+namespace io {
+
+WriteOffloader::WriteOffloader(uint32_t numThreads, uint32_t queueDepth) :
+		next_(0), stop_(false)
+{
+	for (uint32_t i = 0; i < numThreads; ++i)
+		ioThreads_.push_back(new IOThread(std::max<uint32_t>(queueDepth, 1)));
+	for (auto t : ioThreads_)
+		t->thread_ = std::thread(&WriteOffloader::run, this, t);
+}
+WriteOffloader::~WriteOffloader(){
+	stop_ = true;
+	for (auto t : ioThreads_) {
+		{
+			std::lock_guard<std::mutex> lock(t->mutex_);
+		}
+		t->cv_.notify_one();
+		t->thread_.join();
+		delete t;
+	}
+}
+// requests are spread over I/O threads round robin
+bool WriteOffloader::push(FileIOUnix *file, IOScheduleData *data){
+	auto t = ioThreads_[next_++ % ioThreads_.size()];
+	if (!t->queue_.push({file, data}))
+		return false;
+	// pairs with fence in run() : either thread sees sleeping flag,
+	// or thread sees job before it sleeps
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (t->sleeping_) {
+		{
+			std::lock_guard<std::mutex> lock(t->mutex_);
+		}
+		t->cv_.notify_one();
+	}
+
+	return true;
+}
+// remaining jobs are drained before thread exits
+void WriteOffloader::run(IOThread *t){
+	while (true) {
+		Job job;
+		if (t->queue_.pop(job)) {
+			job.file_->finishOffload(job.data_);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(t->mutex_);
+		t->sleeping_ = true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		t->cv_.wait(lock, [this, t] { return stop_ || !t->queue_.empty(); });
+		t->sleeping_ = false;
+		if (stop_ && t->queue_.empty())
+			return;
+	}
+}
+
+}
+
+#endif
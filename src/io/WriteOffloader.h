@@ -0,0 +1,76 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "IFileIO.h"
+#include "MPMCQueue.h"
+
+namespace io {
+
+class FileIOUnix;
+
+/*
+ * A WriteOffloader owns a set of I/O threads that finish synchronous writes
+ * on behalf of the worker threads that issued them. Either every write is
+ * handed over, so that compute and I/O concurrency are sized independently,
+ * or only writes which would have blocked the worker, i.e. when a RWF_NOWAIT
+ * write fails with EAGAIN under writeback throttling.
+ * I/O threads write the remainder of each request with blocking writes,
+ * and then reclaim its buffers.
+ *
+ * Each I/O thread drains its own lock-free queue, fed by all workers,
+ * and only sleeps when its queue is empty.
+ */
+class WriteOffloader
+{
+  public:
+	// each thread queues up to queueDepth requests, rounded up to a power of two
+	WriteOffloader(uint32_t numThreads, uint32_t queueDepth);
+	~WriteOffloader();
+	// returns false if queue of chosen thread is full
+	bool push(FileIOUnix *file, IOScheduleData *data);
+
+  private:
+	struct Job {
+		FileIOUnix *file_;
+		IOScheduleData *data_;
+	};
+	struct IOThread {
+		explicit IOThread(uint32_t queueDepth) : queue_(queueDepth), sleeping_(false)
+		{}
+		MPMCQueue<Job> queue_;
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		std::atomic<bool> sleeping_;
+		std::thread thread_;
+	};
+	void run(IOThread *ioThread);
+
+	std::vector<IOThread*> ioThreads_;
+	std::atomic<uint32_t> next_;
+	std::atomic<bool> stop_;
+};
+
+}
@@ -18,9 +18,16 @@
 #pragma once
 
 #include <cstdint>
+#include <chrono>
 
 namespace io {
 
+// monotonic time in ns
+inline uint64_t nowNs(void){
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 struct BufDim {
 	BufDim() : BufDim(0,0)
 	{}
@@ -35,32 +35,85 @@
 #include "tclap/CmdLine.h"
 
 #include "io/TIFFFormat.h"
+#include "io/StorageGeometry.h"
 #include "timer.h"
+#include "pagecache.h"
 #include "testing.h"
 
 const uint8_t numStrips = 32;
 
+static const char* completionModeNames[] = {"inline", "reaper", "eventfd", "busypoll"};
+
 namespace iobench {
 
 static void run(std::string filename, uint32_t width, uint32_t height, uint16_t numComps, bool direct,
-		uint32_t concurrency, bool doStore, bool doAsynch, bool chunked){
+		uint32_t concurrency, bool doStore, bool doAsynch, bool chunked,
+		const io::IOParams &params){
 #ifndef IOBENCH_HAVE_URING
-	if (doAsynch) {
+	if (doAsynch && !params.linuxAio_) {
 		printf("Uring not enabled - forcing synchronous write.\n");
 		doAsynch = false;
 	}
+#endif
+#ifndef IOBENCH_HAVE_LINUX_AIO
+	if (doAsynch && params.linuxAio_) {
+		printf("Linux AIO not enabled - forcing synchronous write.\n");
+		doAsynch = false;
+	}
 #endif
 	ChronoTimer timer;
 	auto tiffFormat = new io::TIFFFormat(true);
+	tiffFormat->setIOParams(params);
 	tiffFormat->init(width, height, numComps,width * numComps, numStrips, chunked);
 	auto imageStripper = tiffFormat->getImageStripper();
 	if (doStore){
-		remove(filename.c_str());
+		if (!params.overwrite_)
+			remove(filename.c_str());
 	   tiffFormat->encodeInit(filename,direct,concurrency,doAsynch);
 	}
 
-	printf("Run with concurrency = %d, store to disk = %d, direct = %d, use uring = %d\n",
-			concurrency,doStore,direct,doAsynch);
+	bool uring = doAsynch && !params.linuxAio_;
+	printf("Run with concurrency = %d, store to disk = %d, direct = %d, use uring = %d, use aio = %d, use mmap = %d\n",
+			concurrency,doStore,direct,uring,doAsynch && params.linuxAio_,doStore && params.mmap_);
+	if (doStore && (direct || chunked))
+		printf("Alignment : %lu bytes, write size : %lu KB\n",
+				params.alignment_, params.writeSize_ / K);
+	if (doStore && (params.preallocate_ || params.overwrite_))
+		printf("Output file : preallocate = %d, overwrite in place = %d\n",
+				params.preallocate_, params.overwrite_);
+	if (doStore && !direct && params.writeBehindBytes_)
+		printf("Write-behind : %lu MB window per worker, drop cache = %d\n",
+				params.writeBehindBytes_ / (K * K), params.dropCache_);
+	if (uring && params.fixedBufferBytes_)
+		printf("Fixed buffers: %lu MB\n", params.fixedBufferBytes_ / (K * K));
+	if (doStore && !params.mmap_ && params.arenaBytes_)
+		printf("Buffer arena : %lu MB\n", params.arenaBytes_ / (K * K));
+	if (uring && params.registeredFile_)
+		printf("Registered file descriptor\n");
+	if (uring && params.sqPoll_)
+		printf("SQPOLL submission : idle = %d ms, cpu = %d\n",
+				params.sqPollIdle_, params.sqPollCpu_);
+	if (doAsynch)
+		printf("Queue depth : %d%s, completion queue size : %d\n",
+				params.queueDepth_, params.adaptiveDepth_ ? " (adaptive)" : "",
+				params.completionQueueSize_ ? params.completionQueueSize_ : 2 * params.queueDepth_);
+	if (uring && params.ringAggregator_)
+		printf("Ring aggregator : single submission thread and ring, fed by %d worker queues\n",
+				concurrency);
+	else if (uring && params.completionMode_ != io::COMPLETION_INLINE)
+		printf("Completions reaped by %s threads, %d rings per thread\n",
+				completionModeNames[params.completionMode_], params.reaperGroupSize_);
+	if (!doAsynch && params.ioThreads_)
+		printf("Dedicated I/O threads : %d, queue depth %d per thread\n",
+				params.ioThreads_, params.queueDepth_);
+	else if (!doAsynch && params.noWaitThreads_)
+		printf("RWF_NOWAIT writes, with %d offload threads\n", params.noWaitThreads_);
+	if (!doAsynch && params.maxWriteBytes_)
+		printf("Short writes forced : at most %lu bytes per write call\n",
+				params.maxWriteBytes_);
+	if (doAsynch && (params.batchOps_ != 1 || params.batchBytes_))
+		printf("Batched submission : %d operations, %lu bytes, flush per task = %d\n",
+				params.batchOps_, params.batchBytes_, params.taskFlush_);
 	tf::Executor exec(concurrency);
 	tf::Taskflow taskflow;
 	tf::Task* encodeStrips = new tf::Task[imageStripper->numStrips()];
@@ -71,16 +124,15 @@ static void run(std::string filename, uint32_t width, uint32_t height, uint16_t
 		uint32_t currentStrip = strip;
 		encodeStrips[strip].work([&tiffFormat, chunked,
 								  currentStrip,doAsynch,doStore,imageStripper,&exec] {
-			auto strip = imageStripper->getStrip(currentStrip);
 			if (!doStore) {
-				uint64_t len =  strip->logicalLen_;
+				uint64_t len =  imageStripper->stripLen(currentStrip);
 #ifdef _WIN32
-				uint8_t *b = io::IOBuf::alignedAlloc(ALIGNMENT,len);
+				uint8_t *b = io::IOBuf::alignedAlloc(io::defaultAlignment,len);
 				for (uint64_t k = 0; k < len; ++k)
 					b[k] = k%256;
 				free(b);
 #else
-				uint8_t b[len] __attribute__((__aligned__(ALIGNMENT)));
+				uint8_t b[len] __attribute__((__aligned__(io::defaultAlignment)));
 				(void)b;
 				for (uint64_t k = 0; k < len; ++k)
 					b[k] = k%256;
@@ -90,10 +142,10 @@ static void run(std::string filename, uint32_t width, uint32_t height, uint16_t
 					auto chunkArray =
 							tiffFormat->getStripChunkArray((uint32_t)exec.this_worker_id(),
 									currentStrip);
-					uint64_t val = chunkArray->stripChunks_[0]->offset();
-					val += chunkArray->stripChunks_[0]->writeableOffset_;
+					uint64_t val = chunkArray->stripChunks_[0].offset_;
+					val += chunkArray->stripChunks_[0].writeableOffset_;
 					for (uint32_t i = 0; i < chunkArray->numBuffers_; ++i){
-						auto ch = chunkArray->stripChunks_[i];
+						auto ch = chunkArray->stripChunks_ + i;
 						auto b = chunkArray->ioBufs_[i];
 						auto ptr = b->data_;
 						assert(ptr);
@@ -110,13 +162,12 @@ static void run(std::string filename, uint32_t width, uint32_t height, uint16_t
 									i+1,
 									chunkArray->numBuffers_,
 									ch->writeableLen_,
-									ch->len());
+									b->len_);
 #endif
 					}
 					bool ret = tiffFormat->encodePixels((uint32_t)exec.this_worker_id(), chunkArray);
 					(void)ret;
 					assert(ret);
-					delete chunkArray;
 				} else {
 					auto b = tiffFormat->getPoolBuffer((uint32_t)exec.this_worker_id(), currentStrip);
 					auto ptr = b->data_ + b->skip_;
@@ -130,18 +181,99 @@ static void run(std::string filename, uint32_t width, uint32_t height, uint16_t
 			}
 		});
 	}
+	PageCacheMonitor pageCache;
+	bool monitorPageCache = doStore && !direct;
+	if (monitorPageCache)
+		pageCache.start();
 	timer.start();
 	exec.run(taskflow).wait();
 	delete[] encodeStrips;
+	auto stats = tiffFormat->getStats();
+	auto poolStats = tiffFormat->getPoolStats();
+	auto arenaStats = tiffFormat->getArenaStats();
+	auto numaStats = tiffFormat->getNumaStats();
+	auto budgetStats = tiffFormat->getBudgetStats();
+	uint64_t peakSeams = imageStripper->peakSeams();
 	delete tiffFormat;
 	timer.finish("");
+	pageCache.stop();
+	if (monitorPageCache && pageCache.peakKB())
+		printf("peak dirty + writeback page cache : %lu MB\n", pageCache.peakKB() / K);
+	if (stats.writes_)
+		printf("%lu writes, %lu submits, %f submits per write, %lu waits for completion\n",
+				stats.writes_, stats.submits_,
+				(double)stats.submits_ / (double)stats.writes_,
+				stats.waits_);
+	if (stats.reclaims_)
+		printf("time to reclaim : average %f us, maximum %f us\n",
+				(double)stats.reclaimNs_ / (double)stats.reclaims_ / 1000.0,
+				(double)stats.maxReclaimNs_ / 1000.0);
+	if (!params.ioThreads_ && stats.noWaitHits_ + stats.offloads_)
+		printf("RWF_NOWAIT fast path : %lu of %lu writes (%f %%), %lu offloaded\n",
+				stats.noWaitHits_, stats.writes_,
+				100.0 * (double)stats.noWaitHits_ / (double)stats.writes_,
+				stats.offloads_);
+	if (poolStats.gets_)
+		printf("buffer pool : %lu of %lu buffers reused (%f %%), internal fragmentation %f %%\n",
+				poolStats.hits_, poolStats.gets_,
+				100.0 * (double)poolStats.hits_ / (double)poolStats.gets_,
+				100.0 * (double)(poolStats.servedBytes_ - poolStats.requestedBytes_) /
+					(double)poolStats.servedBytes_);
+	if (poolStats.prewarmed_)
+		printf("pre-warmed pools : %lu buffers, %f MB, %f ms summed over workers, before timed run\n",
+				poolStats.prewarmed_, (double)poolStats.prewarmedBytes_ / (double)(K * K),
+				(double)poolStats.prewarmNs_ / 1000000.0);
+	if (poolStats.depotGets_ + poolStats.depotPuts_)
+		printf("buffer depot : %lu magazines of %u buffers stored, %lu taken\n",
+				poolStats.depotPuts_, io::magazineSize, poolStats.depotGets_);
+	if (arenaStats.hugePageBytes_)
+		printf("buffer arena : %lu of %lu slots served, %lu from %lu KB %s huge pages, locked = %d\n",
+				arenaStats.served_, arenaStats.slots_, arenaStats.hugeServed_,
+				arenaStats.hugePageBytes_ / K,
+				arenaStats.transparent_ ? "transparent" : "hugetlb", arenaStats.locked_);
+	else if (arenaStats.slots_)
+		printf("buffer arena : %lu of %lu slots served\n",
+				arenaStats.served_, arenaStats.slots_);
+	if (budgetStats.budget_)
+		printf("memory budget : %lu MB, peak %f MB, average %f MB, %lu waits (%f ms), %lu overruns\n",
+				budgetStats.budget_ / (K * K),
+				(double)budgetStats.peakBytes_ / (double)(K * K),
+				(double)budgetStats.averageBytes_ / (double)(K * K),
+				budgetStats.waits_, (double)budgetStats.waitNs_ / 1000000.0,
+				budgetStats.overruns_);
+	if (peakSeams)
+		printf("seam window : at most %lu chunks shared by neighbouring strips live at once\n",
+				peakSeams);
+	if (numaStats.buffers_)
+		printf("NUMA placement : %u nodes, %lu of %lu buffers written from a remote node (%f %%)\n",
+				numaStats.nodes_, numaStats.remote_, numaStats.buffers_,
+				100.0 * (double)numaStats.remote_ / (double)numaStats.buffers_);
+	if (stats.retries_)
+		printf("%lu operations reissued after short or interrupted transfers\n",
+				stats.retries_);
+	if (stats.errors_)
+		printf("%lu operations failed - output file is incomplete\n", stats.errors_);
 }
-static void run(std::string filename, uint32_t width, uint32_t height,uint16_t numComps,uint8_t concurrency){
-	   run(filename,width,height,numComps,false,concurrency,false,false,false);
-	   run(filename,width,height,numComps,false,concurrency,true,false,false);
-	   run(filename,width,height,numComps,false,concurrency,true,true,false);
-	   run(filename,width,height,numComps,true,concurrency,true,false,true);
-	   run(filename,width,height,numComps,true,concurrency,true,true,true);
+static void run(std::string filename, uint32_t width, uint32_t height,uint16_t numComps,uint8_t concurrency,
+		const io::IOParams &params){
+	   auto writeParams = params;
+	   writeParams.mmap_ = false;
+	   writeParams.linuxAio_ = false;
+	   writeParams.ringAggregator_ = false;
+	   run(filename,width,height,numComps,false,concurrency,false,false,false,writeParams);
+	   run(filename,width,height,numComps,false,concurrency,true,false,false,writeParams);
+	   run(filename,width,height,numComps,false,concurrency,true,true,false,writeParams);
+	   run(filename,width,height,numComps,true,concurrency,true,false,true,writeParams);
+	   run(filename,width,height,numComps,true,concurrency,true,true,true,writeParams);
+	   auto aggregatorParams = writeParams;
+	   aggregatorParams.ringAggregator_ = true;
+	   run(filename,width,height,numComps,true,concurrency,true,true,true,aggregatorParams);
+	   auto aioParams = writeParams;
+	   aioParams.linuxAio_ = true;
+	   run(filename,width,height,numComps,true,concurrency,true,true,true,aioParams);
+	   auto mmapParams = writeParams;
+	   mmapParams.mmap_ = true;
+	   run(filename,width,height,numComps,false,concurrency,true,false,false,mmapParams);
 	   printf("\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\n");
 }
 
@@ -157,6 +289,7 @@ int main(int argc, char** argv)
 	bool fullRun = true;
 	bool direct = false;
 	bool chunked = false;
+	io::IOParams params;
 	std::string filename = "io_out.tif";
 	try
 	{
@@ -181,6 +314,92 @@ int main(int argc, char** argv)
 												  "concurrency",
 												  false, 0, "unsigned integer", cmd);
 		TCLAP::SwitchArg chunkedArg("k", "chunked", "break strips into chunks", cmd);
+		TCLAP::ValueArg<uint32_t> fixedArg("x", "fixed",
+												  "MB of buffer memory registered with uring (fixed buffers)",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg registeredFileArg("r", "regfile",
+												  "register output file descriptor with uring", cmd);
+		TCLAP::SwitchArg sqPollArg("q", "sqpoll",
+												  "submit through a shared kernel SQ poller thread", cmd);
+		TCLAP::ValueArg<uint32_t> sqPollIdleArg("i", "sqidle",
+												  "SQ poller idle time in ms",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::ValueArg<int32_t> sqPollCpuArg("u", "sqcpu",
+												  "cpu for SQ poller thread",
+												  false, -1, "integer", cmd);
+		TCLAP::ValueArg<uint32_t> batchArg("b", "batch",
+												  "number of uring operations per submit",
+												  false, 1, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> batchBytesArg("y", "batchbytes",
+												  "KB of uring writes per submit",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg taskFlushArg("t", "taskflush", "submit queued uring writes at end of each task", cmd);
+		TCLAP::ValueArg<uint32_t> queueDepthArg("o", "depth",
+												  "maximum uring operations in flight per ring",
+												  false, 32, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> cqSizeArg("m", "cqsize",
+												  "uring completion queue size",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg adaptiveArg("a", "adaptive", "adapt uring depth to completion latency", cmd);
+		std::vector<std::string> completionModes(completionModeNames,
+												completionModeNames + 4);
+		TCLAP::ValuesConstraint<std::string> completionConstraint(completionModes);
+		TCLAP::ValueArg<std::string> completionArg("g", "completion",
+												  "uring completion reaping strategy",
+												  false, "inline", &completionConstraint, cmd);
+		TCLAP::ValueArg<uint32_t> groupSizeArg("j", "groupsize",
+												  "rings per completion reaper thread",
+												  false, 4, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> intervalArg("z", "interval",
+												  "reaper thread sweep interval in us",
+												  false, 100, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> busyPollArg("l", "busypoll",
+												  "busy poll time in us before reaper thread sleeps",
+												  false, 50, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> partialArg("p", "partial",
+												  "force short synchronous writes of at most this many KB",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> noWaitArg("v", "nowait",
+												  "try synchronous writes with RWF_NOWAIT, and offload writes that would block to this many threads",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> ioThreadsArg("I", "iothreads",
+												  "hand all synchronous writes to this many dedicated I/O threads",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg preallocateArg("P", "preallocate",
+												  "reserve disk space for whole image before writing", cmd);
+		TCLAP::SwitchArg overwriteArg("O", "overwrite",
+												  "overwrite existing output file in place, rather than truncating it", cmd);
+		TCLAP::ValueArg<uint32_t> writeBehindArg("W", "writebehind",
+												  "buffered mode : MB under writeback per worker before waiting on write-behind",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg dropCacheArg("D", "dropcache",
+												  "drop written pages from page cache after write-behind", cmd);
+		TCLAP::ValueArg<uint32_t> alignmentArg("A", "alignment",
+												  "O_DIRECT alignment in bytes, overriding discovered alignment",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> writeSizeArg("S", "writesize",
+												  "chunk write size in KB, overriding discovered write size",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg mmapArg("M", "mmap",
+												  "write through a shared memory mapping of the output file", cmd);
+		TCLAP::SwitchArg aggregatorArg("G", "aggregate",
+												  "issue uring writes of all workers from a single submission thread and ring", cmd);
+		TCLAP::SwitchArg linuxAioArg("L", "linuxaio",
+												  "asynchronous writes with Linux native AIO rather than io_uring", cmd);
+		TCLAP::ValueArg<uint32_t> arenaArg("B", "arena",
+												  "MB of pool memory carved from a single arena",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::ValueArg<uint32_t> hugePagesArg("H", "hugepages",
+												  "back arena with huge pages of this many MB (2 or 1024)",
+												  false, 0, "unsigned integer", cmd);
+		TCLAP::SwitchArg lockArenaArg("K", "mlock", "lock arena in memory", cmd);
+		TCLAP::SwitchArg numaArg("N", "numa",
+												  "place workers, pools and completion reapers by NUMA node", cmd);
+		TCLAP::SwitchArg prewarmArg("V", "prewarm",
+												  "stock buffer pools before the timed run, and compare with cold pools", cmd);
+		TCLAP::ValueArg<uint32_t> budgetArg("U", "budget",
+												  "MB of pool buffers that may be in use or in flight at once",
+												  false, 0, "unsigned integer", cmd);
 		cmd.parse(argc, argv);
 
 		if (fileArg.isSet())
@@ -207,6 +426,105 @@ int main(int argc, char** argv)
 			useUring = false;
 		if (chunkedArg.isSet())
 			chunked = true;
+		if (fixedArg.isSet())
+			params.fixedBufferBytes_ = (uint64_t)fixedArg.getValue() * K * K;
+		if (registeredFileArg.isSet())
+			params.registeredFile_ = true;
+		if (sqPollArg.isSet())
+			params.sqPoll_ = true;
+		if (sqPollIdleArg.isSet())
+			params.sqPollIdle_ = sqPollIdleArg.getValue();
+		if (sqPollCpuArg.isSet())
+			params.sqPollCpu_ = sqPollCpuArg.getValue();
+		if (batchArg.isSet())
+			params.batchOps_ = batchArg.getValue();
+		if (batchBytesArg.isSet())
+			params.batchBytes_ = (uint64_t)batchBytesArg.getValue() * K;
+		if (taskFlushArg.isSet())
+			params.taskFlush_ = true;
+		if (queueDepthArg.isSet())
+			params.queueDepth_ = queueDepthArg.getValue();
+		if (cqSizeArg.isSet())
+			params.completionQueueSize_ = cqSizeArg.getValue();
+		if (adaptiveArg.isSet())
+			params.adaptiveDepth_ = true;
+		for (uint32_t i = 0; i < completionModes.size(); ++i){
+			if (completionArg.getValue() == completionModes[i])
+				params.completionMode_ = (io::CompletionMode)i;
+		}
+		if (groupSizeArg.isSet())
+			params.reaperGroupSize_ = groupSizeArg.getValue();
+		if (intervalArg.isSet())
+			params.reaperIntervalUs_ = intervalArg.getValue();
+		if (busyPollArg.isSet())
+			params.busyPollUs_ = busyPollArg.getValue();
+		if (noWaitArg.isSet())
+			params.noWaitThreads_ = noWaitArg.getValue();
+		if (ioThreadsArg.isSet())
+			params.ioThreads_ = ioThreadsArg.getValue();
+		if (preallocateArg.isSet())
+			params.preallocate_ = true;
+		if (overwriteArg.isSet())
+			params.overwrite_ = true;
+		if (writeBehindArg.isSet())
+			params.writeBehindBytes_ = (uint64_t)writeBehindArg.getValue() * K * K;
+		if (dropCacheArg.isSet())
+			params.dropCache_ = true;
+		if (mmapArg.isSet()) {
+			if (direct) {
+				std::cerr << "error: mmap writes can't be combined with direct I/O" << std::endl;
+				return 1;
+			}
+			params.mmap_ = true;
+			useUring = false;
+		}
+		if (aggregatorArg.isSet())
+			params.ringAggregator_ = true;
+		if (linuxAioArg.isSet())
+			params.linuxAio_ = true;
+		if (arenaArg.isSet())
+			params.arenaBytes_ = (uint64_t)arenaArg.getValue() * K * K;
+		if (hugePagesArg.isSet()) {
+			uint64_t hugePageBytes = (uint64_t)hugePagesArg.getValue() * K * K;
+			if (!hugePageBytes || (hugePageBytes & (hugePageBytes - 1))) {
+				std::cerr << "error: huge page size must be a power of two" << std::endl;
+				return 1;
+			}
+			if (!params.arenaBytes_ && !params.fixedBufferBytes_) {
+				std::cerr << "error: huge pages require an arena (-B or -x)" << std::endl;
+				return 1;
+			}
+			params.hugePageBytes_ = hugePageBytes;
+		}
+		if (lockArenaArg.isSet())
+			params.lockArena_ = true;
+		if (numaArg.isSet())
+			params.numa_ = true;
+		if (prewarmArg.isSet())
+			params.prewarm_ = true;
+		if (budgetArg.isSet())
+			params.memoryBudgetBytes_ = (uint64_t)budgetArg.getValue() * K * K;
+		io::StorageGeometry geometry;
+		io::discoverStorageGeometry(filename, geometry);
+		if (alignmentArg.isSet()) {
+			uint64_t alignment = alignmentArg.getValue();
+			if (alignment < sizeof(void*) || (alignment & (alignment - 1))) {
+				std::cerr << "error: alignment must be a power of two, at least "
+						<< sizeof(void*) << std::endl;
+				return 1;
+			}
+			geometry.alignment_ = alignment;
+		}
+		if (writeSizeArg.isSet())
+			geometry.writeSize_ = (uint64_t)writeSizeArg.getValue() * K;
+		// write size must be a non-zero multiple of alignment
+		geometry.writeSize_ = std::max(geometry.writeSize_, geometry.alignment_);
+		geometry.writeSize_ = ((geometry.writeSize_ + geometry.alignment_ - 1) /
+								geometry.alignment_) * geometry.alignment_;
+		params.alignment_ = geometry.alignment_;
+		params.writeSize_ = geometry.writeSize_;
+		if (partialArg.isSet())
+			params.maxWriteBytes_ = (uint64_t)partialArg.getValue() * K;
 	}
 	catch(TCLAP::ArgException& e) // catch any exceptions
 	{
@@ -216,14 +534,22 @@ int main(int argc, char** argv)
 	if (fullRun) {
 		for (uint8_t concurrency = 2;
 				concurrency <= (uint32_t)std::thread::hardware_concurrency(); concurrency+=2){
-		   iobench::run(filename,width,height,numComps,concurrency);
+		   iobench::run(filename,width,height,numComps,concurrency,params);
 	   }
 	} else {
-		if (concurrency > 0)
-			iobench::run(filename,width,height,numComps,direct, concurrency, true, useUring,chunked);
-		else
-			iobench::run(filename,width,height,numComps,direct,
-					(uint32_t)std::thread::hardware_concurrency(),true,useUring,chunked);
+		if (concurrency == 0)
+			concurrency = (uint32_t)std::thread::hardware_concurrency();
+		// with pre-warming, a cold run is timed first, for comparison
+		if (params.prewarm_) {
+			auto coldParams = params;
+			coldParams.prewarm_ = false;
+			printf("Cold pools :\n");
+			iobench::run(filename,width,height,numComps,direct, concurrency, true, useUring,chunked,
+					coldParams);
+			printf("Warm pools :\n");
+		}
+		iobench::run(filename,width,height,numComps,direct, concurrency, true, useUring,chunked,
+				params);
 	}
 
    return 0;
@@ -0,0 +1,84 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace iobench {
+
+/*
+ * Samples the system-wide dirty and writeback page cache from /proc/meminfo,
+ * and records its peak, while a run is in progress.
+ */
+class PageCacheMonitor {
+public:
+	PageCacheMonitor(void) : peakKB_(0), stop_(false) {
+	}
+	~PageCacheMonitor(void){
+		stop();
+	}
+	void start(void){
+#ifdef __linux__
+		peakKB_ = 0;
+		stop_ = false;
+		thread_ = std::thread([this] {
+			while (!stop_) {
+				peakKB_ = std::max(peakKB_.load(), sample());
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		});
+#endif
+	}
+	void stop(void){
+		stop_ = true;
+		if (thread_.joinable())
+			thread_.join();
+	}
+	uint64_t peakKB(void) const{
+		return peakKB_;
+	}
+private:
+	// dirty plus writeback KB, or 0 if unavailable
+	static uint64_t sample(void){
+		FILE *f = fopen("/proc/meminfo", "r");
+		if (!f)
+			return 0;
+		char line[256];
+		uint64_t total = 0;
+		while (fgets(line, sizeof(line), f)) {
+			unsigned long long kb;
+			if (sscanf(line, "Dirty: %llu kB", &kb) == 1 ||
+					sscanf(line, "Writeback: %llu kB", &kb) == 1)
+				total += kb;
+		}
+		fclose(f);
+
+		return total;
+	}
+	std::atomic<uint64_t> peakKB_;
+	std::atomic<bool> stop_;
+	std::thread thread_;
+};
+
+}
@@ -0,0 +1,271 @@
+/*
+ *    Copyright (C) 2022 Grok Image Compression Inc.
+ *
+ *    This source code is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This source code is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Checks that the steady state write path makes no heap allocation.
+ *
+ * For each write mode, the first half of the image's strips is written as a
+ * warm-up pass, which stocks pools with the buffers and requests in flight.
+ * The remaining strips, except the last one, are then written as a measured
+ * pass, which must make no call to operator new. The last strip finishes the
+ * image, i.e. writes the tiff directory, so it is written once counting stops.
+ *
+ * When writes complete on another thread, or asynchronously, the number of
+ * buffers and requests in flight depends on timing, so a warm-up pass may
+ * not reach it. These modes bound buffers in flight with a memory budget,
+ * and pre-warm pools up to the budget. A writer overruns the budget if the
+ * device stalls, and the run is then repeated.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "iobench_config.h"
+#include "io/TIFFFormat.h"
+
+static std::atomic<bool> counting(false);
+static std::atomic<uint64_t> allocations(0);
+
+static void* countedAlloc(std::size_t size){
+	if (counting)
+		allocations++;
+	void *p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+static void* countedAlignedAlloc(std::size_t size, std::align_val_t alignment){
+	if (counting)
+		allocations++;
+	size_t align = std::max<size_t>((size_t)alignment, sizeof(void*));
+	void *p = nullptr;
+	if (posix_memalign(&p, align, size ? size : 1) != 0)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(std::size_t size){
+	return countedAlloc(size);
+}
+void* operator new[](std::size_t size){
+	return countedAlloc(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept{
+	try {
+		return countedAlloc(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept{
+	try {
+		return countedAlloc(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+void* operator new(std::size_t size, std::align_val_t alignment){
+	return countedAlignedAlloc(size, alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment){
+	return countedAlignedAlloc(size, alignment);
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept{
+	try {
+		return countedAlignedAlloc(size, alignment);
+	} catch (...) {
+		return nullptr;
+	}
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept{
+	try {
+		return countedAlignedAlloc(size, alignment);
+	} catch (...) {
+		return nullptr;
+	}
+}
+void operator delete(void *p) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p) noexcept{
+	std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept{
+	std::free(p);
+}
+void operator delete(void *p, const std::nothrow_t&) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t&) noexcept{
+	std::free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept{
+	std::free(p);
+}
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept{
+	std::free(p);
+}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept{
+	std::free(p);
+}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept{
+	std::free(p);
+}
+
+// rows per strip
+const uint32_t stripHeight = 32;
+const uint32_t width = 4000;
+// strips all have the same length, apart from the first, which holds the header
+const uint32_t height = 64 * stripHeight;
+// bound on buffers in flight, in buffers : at least a strip's chunks
+const uint64_t budgetBuffers = 8;
+// number of times a run that overran its budget is repeated
+const uint32_t maxAttempts = 4;
+
+struct WriteMode {
+	const char *name_;
+	bool direct_;
+	bool asynch_;
+	bool chunked_;
+	io::IOParams params_;
+};
+
+static bool writeStrip(io::TIFFFormat *tiffFormat, bool chunked, uint32_t strip){
+	if (chunked) {
+		auto chunkArray = tiffFormat->getStripChunkArray(0, strip);
+		for (uint32_t i = 0; i < chunkArray->numBuffers_; ++i){
+			auto ch = chunkArray->stripChunks_ + i;
+			auto b = chunkArray->ioBufs_[i];
+			memset(b->data_ + ch->writeableOffset_, (int)strip, ch->writeableLen_);
+		}
+		return tiffFormat->encodePixels(0, chunkArray);
+	}
+	auto b = tiffFormat->getPoolBuffer(0, strip);
+	memset(b->data_ + b->skip_, (int)strip, b->len_ - b->skip_);
+
+	return tiffFormat->encodePixels(0, &b, 1);
+}
+
+// budget and pre-warmed pools for writes in flight
+static io::IOParams bounded(io::IOParams params, bool chunked){
+	uint64_t len = chunked ? params.writeSize_ : (uint64_t)width * stripHeight;
+	params.memoryBudgetBytes_ = budgetBuffers * len;
+	params.prewarm_ = true;
+
+	return params;
+}
+
+// returns number of allocations made by measured pass, or -1 on failure.
+// overran is set if a writer exceeded the memory budget
+static int64_t run(const WriteMode &mode, const std::string &filename, bool &overran){
+	remove(filename.c_str());
+	auto tiffFormat = new io::TIFFFormat(true);
+	tiffFormat->setIOParams(mode.params_);
+	tiffFormat->init(width, height, 1, width, stripHeight, mode.chunked_);
+	if (!tiffFormat->encodeInit(filename, mode.direct_, 1, mode.asynch_)){
+		delete tiffFormat;
+		return -1;
+	}
+	uint32_t numStrips = tiffFormat->getImageStripper()->numStrips();
+	uint32_t warmup = numStrips / 2;
+	bool rc = true;
+	for (uint32_t strip = 0; strip < warmup; ++strip)
+		rc &= writeStrip(tiffFormat, mode.chunked_, strip);
+	allocations = 0;
+	counting = true;
+	for (uint32_t strip = warmup; strip < numStrips - 1; ++strip)
+		rc &= writeStrip(tiffFormat, mode.chunked_, strip);
+	counting = false;
+	uint64_t measured = allocations;
+	rc &= writeStrip(tiffFormat, mode.chunked_, numStrips - 1);
+	rc &= tiffFormat->close();
+	overran = tiffFormat->getBudgetStats().overruns_ != 0;
+	delete tiffFormat;
+	remove(filename.c_str());
+
+	return rc ? (int64_t)measured : -1;
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = argc > 1 ? argv[1] : "alloc_test.tif";
+	std::vector<WriteMode> modes;
+	io::IOParams params;
+	modes.push_back({"synchronous", false, false, false, params});
+	modes.push_back({"synchronous direct chunked", true, false, true, params});
+	auto writeBehindParams = params;
+	writeBehindParams.writeBehindBytes_ = 1024 * 1024;
+	modes.push_back({"write-behind", false, false, false, writeBehindParams});
+	auto ioThreadParams = bounded(params, true);
+	ioThreadParams.ioThreads_ = 2;
+	modes.push_back({"dedicated I/O threads", true, false, true, ioThreadParams});
+	auto mmapParams = params;
+	mmapParams.mmap_ = true;
+	modes.push_back({"mmap", false, false, false, mmapParams});
+	modes.push_back({"mmap chunked", false, false, true, mmapParams});
+#ifdef IOBENCH_HAVE_URING
+	modes.push_back({"uring", false, true, false, bounded(params, false)});
+	modes.push_back({"uring direct chunked", true, true, true, bounded(params, true)});
+	auto reaperParams = bounded(params, true);
+	reaperParams.completionMode_ = io::COMPLETION_REAPER;
+	modes.push_back({"uring completion reaper", true, true, true, reaperParams});
+	auto aggregatorParams = bounded(params, true);
+	aggregatorParams.ringAggregator_ = true;
+	modes.push_back({"uring ring aggregator", true, true, true, aggregatorParams});
+#endif
+#ifdef IOBENCH_HAVE_LINUX_AIO
+	auto aioParams = bounded(params, true);
+	aioParams.linuxAio_ = true;
+	modes.push_back({"linux aio direct chunked", true, true, true, aioParams});
+#endif
+	int rc = EXIT_SUCCESS;
+	for (auto &mode : modes){
+		int64_t count = 0;
+		for (uint32_t attempt = 0; attempt < maxAttempts; ++attempt){
+			bool overran = false;
+			count = run(mode, filename, overran);
+			if (count <= 0 || !overran)
+				break;
+		}
+		if (count < 0) {
+			printf("%-28s : write failed\n", mode.name_);
+			rc = EXIT_FAILURE;
+		} else if (count) {
+			printf("%-28s : %ld heap allocations after warm-up\n", mode.name_, count);
+			rc = EXIT_FAILURE;
+		} else {
+			printf("%-28s : no heap allocation after warm-up\n", mode.name_);
+		}
+	}
+
+	return rc;
+}